@@ -13,6 +13,47 @@ using cyclus::Material;
 
 namespace cycamore {
 
+// U-235 atom fractions closer than this share an offer composition
+static const double kOfferAssayTol = 1e-12;
+
+// offer and feed composition caches are cleared when they grow beyond this
+// many entries, to stay bounded when compositions keep changing
+static const int kMaxOfferComps = 4096;
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void EnrichmentBatch::Add(Material::Ptr offer, double assay) {
+  rows_[offer.get()] = offers_.size();
+  offers_.push_back(offer);
+  assays_.push_back(assay);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void EnrichmentBatch::Compute() {
+  using cyclus::toolkit::ValueFunc;
+
+  // same as toolkit FeedQty, TailsQty and SwuRequired per kg of product, with
+  // the feed and tails terms hoisted out of the loop
+  int n = assays_.size();
+  swu_per_kg_.resize(n);
+  feed_per_kg_.resize(n);
+  if (n == 0) {
+    return;
+  }
+  double v_feed = ValueFunc(feed_);
+  double v_tails = ValueFunc(tails_);
+  double span = feed_ - tails_;
+  const double* x = &assays_[0];
+  double* swu = &swu_per_kg_[0];
+  double* feed = &feed_per_kg_[0];
+  for (int i = 0; i < n; i++) {
+    double f = (x[i] - tails_) / span;
+    double t = (x[i] - feed_) / span;
+    double v_prod = (1 - 2 * x[i]) * std::log(1 / x[i] - 1);
+    feed[i] = f;
+    swu[i] = v_prod + t * v_tails - f * v_feed;
+  }
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 Enrichment::Enrichment(cyclus::Context* ctx)
     : cyclus::Facility(ctx),
@@ -24,7 +65,17 @@ Enrichment::Enrichment(cyclus::Context* ctx)
       feed_recipe(""),
       product_commod(""),
       tails_commod(""),
-      order_prefs(true) {}
+      order_prefs(true),
+      swu_capacity_ramp(false),
+      optimize_tails(false),
+      feed_cost(1),
+      swu_cost(1),
+      current_tails_assay(0),
+      feed_u235_(0),
+      feed_u238_(0),
+      feed_indexed_(false),
+      suppressed_feed_warnings_(0),
+      recorded_feed_warnings_(0) {}
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 Enrichment::~Enrichment() {}
@@ -45,8 +96,10 @@ std::string Enrichment::str() {
 void Enrichment::Build(cyclus::Agent* parent) {
   Facility::Build(parent);
   if (initial_feed > 0) {
-    inventory.Push(Material::Create(this, initial_feed,
-                                    context()->GetRecipe(feed_recipe)));
+    Material::Ptr feed = Material::Create(this, initial_feed,
+                                          context()->GetRecipe(feed_recipe));
+    inventory.Push(feed);
+    UpdateFeed_(feed, 1);
   }
 
   LOG(cyclus::LEV_DEBUG2, "EnrFac") << "Enrichment "
@@ -57,11 +110,104 @@ void Enrichment::Build(cyclus::Agent* parent) {
 void Enrichment::EnterNotify() {
   cyclus::Facility::EnterNotify();
   InitializePosition();
+
+  std::stringstream ss;
+  if (optimize_tails && (feed_cost <= 0 || swu_cost <= 0)) {
+    ss << "prototype '" << prototype() << "' has non-positive feed_cost or"
+       << " swu_cost, which are required to optimize the tails assay\n";
+  }
+  if (!cascade_swu_capacities.empty()) {
+    double total = 0;
+    for (int i = 0; i < cascade_swu_capacities.size(); i++) {
+      if (cascade_swu_capacities[i] < 0) {
+        ss << "prototype '" << prototype() << "' has a negative cascade"
+           << " SWU capacity\n";
+        break;
+      }
+      total += cascade_swu_capacities[i];
+    }
+    if (swu_capacity != cyclus::CY_LARGE_DOUBLE &&
+        !cyclus::AlmostEq(swu_capacity, total)) {
+      ss << "prototype '" << prototype() << "' has a swu_capacity of "
+         << swu_capacity << " that differs from the total cascade SWU"
+         << " capacity of " << total << ", give only one of them\n";
+    }
+    swu_capacity = total;
+  }
+  if (swu_capacity_times.size() != swu_capacity_vals.size()) {
+    ss << "prototype '" << prototype() << "' has "
+       << swu_capacity_times.size() << " swu_capacity_times but "
+       << swu_capacity_vals.size() << " swu_capacity_vals\n";
+  }
+  if (!swu_capacity_times.empty() && !cascade_swu_capacities.empty()) {
+    ss << "prototype '" << prototype() << "' has both a SWU capacity"
+       << " schedule and cascade SWU capacities, only one may be given\n";
+  }
+  for (int i = 0; i < swu_capacity_times.size(); i++) {
+    if (i > 0 && swu_capacity_times[i] <= swu_capacity_times[i - 1]) {
+      ss << "prototype '" << prototype() << "' has swu_capacity_times that"
+         << " are not increasing\n";
+      break;
+    }
+  }
+  for (int i = 0; i < swu_capacity_vals.size(); i++) {
+    if (swu_capacity_vals[i] < 0) {
+      ss << "prototype '" << prototype() << "' has a negative scheduled SWU"
+         << " capacity\n";
+      break;
+    }
+  }
+  if (ss.str().size() > 0) {
+    throw cyclus::ValueError(ss.str());
+  }
+
+  ScheduleSwu_();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Enrichment::ScheduleSwu_() {
+  swu_schedule_.clear();
+  if (swu_capacity_times.empty()) {
+    return;
+  }
+
+  int n = context()->sim_info().duration;
+  int npts = swu_capacity_times.size();
+  swu_schedule_.assign(n, swu_capacity);
+  int k = -1;  // last schedule point at or before t
+  for (int t = 0; t < n; t++) {
+    while (k + 1 < npts && swu_capacity_times[k + 1] <= t) {
+      k++;
+    }
+    if (k < 0) {
+      continue;
+    }
+    double cap = swu_capacity_vals[k];
+    if (swu_capacity_ramp && k + 1 < npts) {
+      double f = static_cast<double>(t - swu_capacity_times[k]) /
+                 (swu_capacity_times[k + 1] - swu_capacity_times[k]);
+      cap += f * (swu_capacity_vals[k + 1] - swu_capacity_vals[k]);
+    }
+    swu_schedule_[t] = cap;
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double Enrichment::SwuCapacityAt_(int time) {
+  if (swu_capacity_times.empty()) {
+    return SwuCapacity();
+  }
+  if (swu_schedule_.empty()) {
+    ScheduleSwu_();
+  }
+  return swu_schedule_[std::min(std::max(time, 0),
+                                static_cast<int>(swu_schedule_.size()) - 1)];
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 void Enrichment::Tick() {
-  current_swu_capacity = SwuCapacity();
+  current_swu_capacity = SwuCapacityAt_(context()->time());
+  cascade_swu_used_.assign(cascade_swu_capacities.size(), 0);
 
 }
 
@@ -75,6 +221,17 @@ void Enrichment::Tock() {
                                    << intra_timestep_feed_ << " feed";
   RecordTimeSeries<cyclus::toolkit::ENRICH_FEED>(this, intra_timestep_feed_);
   RecordTimeSeries<double>("demand"+feed_commod, this, intra_timestep_feed_);
+
+  if (suppressed_feed_warnings_ > recorded_feed_warnings_) {
+    context()
+        ->NewDatum("EnrichmentFeedWarnings")
+        ->AddVal("AgentId", id())
+        ->AddVal("Time", context()->time())
+        ->AddVal("Suppressed",
+                 suppressed_feed_warnings_ - recorded_feed_warnings_)
+        ->Record();
+    recorded_feed_warnings_ = suppressed_feed_warnings_;
+  }
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -96,17 +253,12 @@ Enrichment::GetMatlRequests() {
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-bool SortBids(cyclus::Bid<Material>* i,
-              cyclus::Bid<Material>* j) {
-  Material::Ptr mat_i = i->offer();
-  Material::Ptr mat_j = j->offer();
-
-  cyclus::toolkit::MatQuery mq_i(mat_i);
-  cyclus::toolkit::MatQuery mq_j(mat_j);
+typedef std::pair<double, cyclus::Bid<Material>*> BidKey;
 
-  return ((mq_i.mass(922350000) / mq_i.qty()) <=
-          (mq_j.mass(922350000) / mq_j.qty()));
+bool SortBids(const BidKey& i, const BidKey& j) {
+  return i.first < j.first;
 }
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 // Sort offers of input material to have higher preference for more
 //  U-235 content
@@ -118,36 +270,48 @@ void Enrichment::AdjustMatlPrefs(
     return;
   }
 
+  // U-235 mass fraction of each offered composition, computed once and shared
+  // by all requests
+  std::unordered_map<int, double> u235_fracs;
+
   cyclus::PrefMap<Material>::type::iterator reqit;
 
   // Loop over all requests
   for (reqit = prefs.begin(); reqit != prefs.end(); ++reqit) {
-    std::vector<Bid<Material>*> bids_vector;
+    std::vector<BidKey> bids_vector;
+    bids_vector.reserve(reqit->second.size());
     std::map<Bid<Material>*, double>::iterator mit;
     for (mit = reqit->second.begin(); mit != reqit->second.end(); ++mit) {
       Bid<Material>* bid = mit->first;
-      bids_vector.push_back(bid);
+      cyclus::Composition::Ptr c = bid->offer()->comp();
+      std::unordered_map<int, double>::iterator fit = u235_fracs.find(c->id());
+      if (fit == u235_fracs.end()) {
+        const cyclus::CompMap& mass = c->mass();
+        double tot = 0;
+        double u235 = 0;
+        cyclus::CompMap::const_iterator it;
+        for (it = mass.begin(); it != mass.end(); ++it) {
+          tot += it->second;
+          if (it->first == 922350000) {
+            u235 = it->second;
+          }
+        }
+        fit = u235_fracs.insert(
+            std::make_pair(c->id(), tot > 0 ? u235 / tot : 0)).first;
+      }
+      bids_vector.push_back(std::make_pair(fit->second, bid));
     }
-    std::sort(bids_vector.begin(), bids_vector.end(), SortBids);
+    std::stable_sort(bids_vector.begin(), bids_vector.end(), SortBids);
 
     // Assign preferences to the sorted vector
-    double n_bids = bids_vector.size();
-    bool u235_mass = 0;
-
     for (int bidit = 0; bidit < bids_vector.size(); bidit++) {
       int new_pref = bidit + 1;
 
       // For any bids with U-235 qty=0, set pref to zero.
-      if (!u235_mass) {
-        Material::Ptr mat = bids_vector[bidit]->offer();
-        cyclus::toolkit::MatQuery mq(mat);
-        if (mq.mass(922350000) == 0) {
-          new_pref = -1;
-        } else {
-          u235_mass = true;
-        }
+      if (bids_vector[bidit].first == 0) {
+        new_pref = -1;
       }
-      (reqit->second)[bids_vector[bidit]] = new_pref;
+      (reqit->second)[bids_vector[bidit].second] = new_pref;
     }  // each bid
   }    // each Material Request
 }
@@ -172,29 +336,30 @@ std::set<cyclus::BidPortfolio<Material>::Ptr> Enrichment::GetMatlBids(
   using cyclus::CapacityConstraint;
   using cyclus::Converter;
   using cyclus::Request;
-  using cyclus::toolkit::MatVec;
   using cyclus::toolkit::RecordTimeSeries;
 
   std::set<BidPortfolio<Material>::Ptr> ports;
+  batch_.reset();
 
   RecordTimeSeries<double>("supply" + tails_commod, this, tails.quantity());
   RecordTimeSeries<double>("supply" + product_commod, this, inventory.quantity());
   if ((out_requests.count(tails_commod) > 0) && (tails.quantity() > 0)) {
     BidPortfolio<Material>::Ptr tails_port(new BidPortfolio<Material>());
 
+    // tails are merged into one material as they are produced (see
+    // PushTails_), so it is offered as is - trades are popped from the tails
+    // buffer by quantity anyway.  Only a buffer restored from a snapshot
+    // taken before tails were merged can hold more than one.
+    if (tails.count() > 1) {
+      tails.Push(cyclus::toolkit::Squash(tails.PopN(tails.count())));
+    }
+    Material::Ptr offer = tails.Peek();
+
     std::vector<Request<Material>*>& tails_requests =
         out_requests[tails_commod];
     std::vector<Request<Material>*>::iterator it;
     for (it = tails_requests.begin(); it != tails_requests.end(); ++it) {
-      // offer bids for all tails material, keeping discrete quantities
-      // to preserve possible variation in composition
-      MatVec mats = tails.PopN(tails.count());
-      tails.Push(mats);
-      for (int k = 0; k < mats.size(); k++) {
-        Material::Ptr m = mats[k];
-        Request<Material>* req = *it;
-        tails_port->AddBid(req, m, this);
-      }
+      tails_port->AddBid(*it, offer, this);
     }
     // overbidding (bidding on every offer)
     // add an overall capacity constraint
@@ -211,6 +376,30 @@ std::set<cyclus::BidPortfolio<Material>::Ptr> Enrichment::GetMatlBids(
 
     std::vector<Request<Material>*>& commod_requests =
         out_requests[product_commod];
+    if (optimize_tails) {
+      current_tails_assay = OptimalTailsAssay(FeedAssay(), feed_cost,
+                                              swu_cost);
+      // keep enough feed and SWU to meet every request if the optimum alone
+      // would not
+      std::vector<double> assays;
+      std::vector<double> qtys;
+      std::vector<Request<Material>*>::iterator it;
+      for (it = commod_requests.begin(); it != commod_requests.end(); ++it) {
+        Material::Ptr mat = (*it)->target();
+        double request_enrich = cyclus::toolkit::UraniumAssayMass(mat);
+        if (ValidReq(mat) && request_enrich <= max_enrich) {
+          assays.push_back(request_enrich);
+          qtys.push_back(mat->quantity());
+        }
+      }
+      current_tails_assay = ConstrainTailsAssay(
+          current_tails_assay, FeedAssay(), assays, qtys,
+          inventory.quantity(), current_swu_capacity);
+      LOG(cyclus::LEV_INFO4, "EnrFac") << prototype() << " uses a tails assay"
+                                       << " of " << current_tails_assay;
+    }
+    EnrichmentBatch::Ptr batch(
+        new EnrichmentBatch(FeedAssay(), TailsAssay_()));
     std::vector<Request<Material>*>::iterator it;
     for (it = commod_requests.begin(); it != commod_requests.end(); ++it) {
       Request<Material>* req = *it;
@@ -221,12 +410,17 @@ std::set<cyclus::BidPortfolio<Material>::Ptr> Enrichment::GetMatlBids(
            (cyclus::AlmostEq(request_enrich, max_enrich)))) {
         Material::Ptr offer = Offer_(req->target());
         commod_port->AddBid(req, offer, this);
+        batch->Add(offer, request_enrich);
       }
     }
-
-    Converter<Material>::Ptr sc(new SWUConverter(FeedAssay(), tails_assay));
-    Converter<Material>::Ptr nc(new NatUConverter(FeedAssay(), tails_assay));
-    CapacityConstraint<Material> swu(swu_capacity, sc);
+    batch->Compute();
+    batch_ = batch;
+
+    Converter<Material>::Ptr sc(
+        new SWUConverter(batch->feed(), batch->tails(), batch));
+    Converter<Material>::Ptr nc(
+        new NatUConverter(batch->feed(), batch->tails(), batch));
+    CapacityConstraint<Material> swu(SwuCapacityAt_(context()->time()), sc);
     CapacityConstraint<Material> natu(inventory.quantity(), nc);
     commod_port->AddConstraint(swu);
     commod_port->AddConstraint(natu);
@@ -245,7 +439,7 @@ bool Enrichment::ValidReq(const Material::Ptr mat) {
   cyclus::toolkit::MatQuery q(mat);
   double u235 = q.atom_frac(922350000);
   double u238 = q.atom_frac(922380000);
-  return (u238 > 0 && u235 / (u235 + u238) > tails_assay);
+  return (u238 > 0 && u235 / (u235 + u238) > TailsAssay_());
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -258,26 +452,41 @@ void Enrichment::GetMatlTrades(
   intra_timestep_swu_ = 0;
   intra_timestep_feed_ = 0;
 
-  std::vector<Trade<Material>>::const_iterator it;
-  for (it = trades.begin(); it != trades.end(); ++it) {
-    double qty = it->amt;
-    std::string commod_type = it->bid->request()->commodity();
-    Material::Ptr response;
+  // tails trades are served directly, product trades are enriched together
+  // from a single feed material
+  std::vector<Material::Ptr> mats(trades.size());
+  std::vector<int> product_trades;
+  std::vector<Material::Ptr> offers;
+  std::vector<double> qtys;
+  for (int i = 0; i < trades.size(); i++) {
+    const Trade<Material>& trade = trades[i];
     // Figure out whether material is tails or enriched,
     // if tails then make transfer of material
-    if (commod_type == tails_commod) {
+    if (trade.bid->request()->commodity() == tails_commod) {
       LOG(cyclus::LEV_INFO5, "EnrFac")
           << prototype() << " just received an order"
-          << " for " << it->amt << " of " << tails_commod;
-      double pop_qty = std::min(qty, tails.quantity());
-      response = tails.Pop(pop_qty, cyclus::eps_rsrc());
+          << " for " << trade.amt << " of " << tails_commod;
+      double pop_qty = std::min(trade.amt, tails.quantity());
+      mats[i] = tails.Pop(pop_qty, cyclus::eps_rsrc());
     } else {
       LOG(cyclus::LEV_INFO5, "EnrFac")
           << prototype() << " just received an order"
-          << " for " << it->amt << " of " << product_commod;
-      response = Enrich_(it->bid->offer(), qty);
+          << " for " << trade.amt << " of " << product_commod;
+      product_trades.push_back(i);
+      offers.push_back(trade.bid->offer());
+      qtys.push_back(trade.amt);
     }
-    responses.push_back(std::make_pair(*it, response));
+  }
+
+  if (!product_trades.empty()) {
+    std::vector<Material::Ptr> products = EnrichAll_(offers, qtys);
+    for (int k = 0; k < product_trades.size(); k++) {
+      mats[product_trades[k]] = products[k];
+    }
+  }
+
+  for (int i = 0; i < trades.size(); i++) {
+    responses.push_back(std::make_pair(trades[i], mats[i]));
   }
 
   if (cyclus::IsNegative(tails.quantity())) {
@@ -294,29 +503,44 @@ void Enrichment::GetMatlTrades(
 }
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 void Enrichment::AddMat_(Material::Ptr mat) {
-  // Elements and isotopes other than U-235, U-238 are sent directly to tails
-  cyclus::CompMap cm = mat->comp()->atom();
-  bool extra_u = false;
-  bool other_elem = false;
-  for (cyclus::CompMap::const_iterator it = cm.begin(); it != cm.end(); ++it) {
-    if (pyne::nucname::znum(it->first) == 92) {
-      if (pyne::nucname::anum(it->first) != 235 &&
-          pyne::nucname::anum(it->first) != 238 && it->second > 0) {
-        extra_u = true;
+  // Elements and isotopes other than U-235, U-238 are sent directly to tails.
+  // Compositions are immutable, so each one is only checked and warned about
+  // once.
+  int comp_id = mat->comp()->id();
+  std::unordered_map<int, int>::iterator flags = feed_comp_flags_.find(comp_id);
+  if (flags != feed_comp_flags_.end()) {
+    if (flags->second != 0) {
+      suppressed_feed_warnings_++;
+    }
+  } else {
+    const cyclus::CompMap& cm = mat->comp()->atom();
+    bool extra_u = false;
+    bool other_elem = false;
+    for (cyclus::CompMap::const_iterator it = cm.begin(); it != cm.end();
+         ++it) {
+      if (pyne::nucname::znum(it->first) == 92) {
+        if (pyne::nucname::anum(it->first) != 235 &&
+            pyne::nucname::anum(it->first) != 238 && it->second > 0) {
+          extra_u = true;
+        }
+      } else if (it->second > 0) {
+        other_elem = true;
       }
-    } else if (it->second > 0) {
-      other_elem = true;
     }
-  }
-  if (extra_u) {
-    cyclus::Warn<cyclus::VALUE_WARNING>(
-        "More than 2 isotopes of U.  "
-        "Istopes other than U-235, U-238 are sent directly to tails.");
-  }
-  if (other_elem) {
-    cyclus::Warn<cyclus::VALUE_WARNING>(
-        "Non-uranium elements are "
-        "sent directly to tails.");
+    if (extra_u) {
+      cyclus::Warn<cyclus::VALUE_WARNING>(
+          "More than 2 isotopes of U.  "
+          "Istopes other than U-235, U-238 are sent directly to tails.");
+    }
+    if (other_elem) {
+      cyclus::Warn<cyclus::VALUE_WARNING>(
+          "Non-uranium elements are "
+          "sent directly to tails.");
+    }
+    if (feed_comp_flags_.size() >= kMaxOfferComps) {
+      feed_comp_flags_.clear();
+    }
+    feed_comp_flags_[comp_id] = (extra_u ? 1 : 0) | (other_elem ? 2 : 0);
   }
 
   LOG(cyclus::LEV_INFO5, "EnrFac") << prototype() << " is initially holding "
@@ -328,6 +552,7 @@ void Enrichment::AddMat_(Material::Ptr mat) {
     e.msg(Agent::InformErrorMsg(e.msg()));
     throw e;
   }
+  UpdateFeed_(mat, 1);
 
   LOG(cyclus::LEV_INFO5, "EnrFac")
       << prototype() << " added " << mat->quantity() << " of " << feed_commod
@@ -344,41 +569,85 @@ Material::Ptr Enrichment::Request_() {
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 Material::Ptr Enrichment::Offer_(Material::Ptr mat) {
-  cyclus::toolkit::MatQuery q(mat);
-  cyclus::CompMap comp;
-  comp[922350000] = q.atom_frac(922350000);
-  comp[922380000] = q.atom_frac(922380000);
-  return Material::CreateUntracked(
-      mat->quantity(), cyclus::Composition::CreateFromAtom(comp));
+  return Material::CreateUntracked(mat->quantity(), OfferComp_(mat->comp()));
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+cyclus::Composition::Ptr Enrichment::OfferComp_(cyclus::Composition::Ptr c) {
+  std::unordered_map<int, cyclus::Composition::Ptr>::iterator it =
+      offer_comps_.find(c->id());
+  if (it != offer_comps_.end()) {
+    return it->second;
+  }
+
+  if (offer_comps_.size() >= kMaxOfferComps) {
+    offer_comps_.clear();
+  }
+  if (offer_assays_.size() >= kMaxOfferComps) {
+    offer_assays_.clear();
+  }
+
+  const cyclus::CompMap& atom = c->atom();
+  cyclus::CompMap::const_iterator u235 = atom.find(922350000);
+  cyclus::CompMap::const_iterator u238 = atom.find(922380000);
+  double n235 = u235 == atom.end() ? 0 : u235->second;
+  double n238 = u238 == atom.end() ? 0 : u238->second;
+  double frac = n235 + n238 > 0 ? n235 / (n235 + n238) : 0;
+  long long bucket = std::llround(frac / kOfferAssayTol);
+
+  cyclus::Composition::Ptr& comp = offer_assays_[bucket];
+  if (!comp) {
+    cyclus::CompMap v;
+    v[922350000] = n235;
+    v[922380000] = n238;
+    comp = cyclus::Composition::CreateFromAtom(v);
+  }
+  offer_comps_[c->id()] = comp;
+  return comp;
 }
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 Material::Ptr Enrichment::Enrich_(Material::Ptr mat,
                                           double qty) {
+  return EnrichAll_(std::vector<Material::Ptr>(1, mat),
+                    std::vector<double>(1, qty))[0];
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+std::vector<Material::Ptr> Enrichment::EnrichAll_(
+    const std::vector<Material::Ptr>& mats, const std::vector<double>& qtys) {
   using cyclus::toolkit::Assays;
   using cyclus::toolkit::UraniumAssayMass;
   using cyclus::toolkit::SwuRequired;
   using cyclus::toolkit::FeedQty;
-  using cyclus::toolkit::TailsQty;
 
-  // get enrichment parameters
-  Assays assays(FeedAssay(), UraniumAssayMass(mat), tails_assay);
-  double swu_req = SwuRequired(qty, assays);
-  double natu_req = FeedQty(qty, assays);
+  // get enrichment parameters, from this time step's bids if the feed assay
+  // has not changed since
+  double feed_assay = FeedAssay();
+  double tails_assay_used = TailsAssay_();
+  bool use_batch = batch_ && cyclus::AlmostEq(batch_->feed(), feed_assay) &&
+                   cyclus::AlmostEq(batch_->tails(), tails_assay_used);
+  double swu_req = 0;
+  double natu_req = 0;
+  double product_qty = 0;
+  for (int i = 0; i < mats.size(); i++) {
+    int row = use_batch ? batch_->row(mats[i].get()) : -1;
+    if (row >= 0) {
+      swu_req += batch_->swu_per_kg(row) * qtys[i];
+      natu_req += batch_->feed_per_kg(row) * qtys[i];
+    } else {
+      Assays assays(feed_assay, UraniumAssayMass(mats[i]), tails_assay_used);
+      swu_req += SwuRequired(qtys[i], assays);
+      natu_req += FeedQty(qtys[i], assays);
+    }
+    product_qty += qtys[i];
+  }
 
   // Determine the composition of the natural uranium
   // (ie. U-235+U-238/TotalMass)
-  double pop_qty = inventory.quantity();
-  Material::Ptr natu_matl = inventory.Pop(pop_qty, cyclus::eps_rsrc());
-  inventory.Push(natu_matl);
-
-  cyclus::toolkit::MatQuery mq(natu_matl);
-  std::set<cyclus::Nuc> nucs;
-  nucs.insert(922350000);
-  nucs.insert(922380000);
-  double natu_frac = mq.mass_frac(nucs);
-  double feed_req = natu_req / natu_frac;
-
-  // pop amount from inventory and blob it into one material
+  double feed_req = natu_req / FeedNatUFrac_();
+
+  // pop the feed for all enrichments from inventory and blob it into one
+  // material
   Material::Ptr r;
   try {
     // required so popping doesn't take out too much
@@ -388,48 +657,88 @@ Material::Ptr Enrichment::Enrich_(Material::Ptr mat,
       r = inventory.Pop(feed_req, cyclus::eps_rsrc());
     }
   } catch (cyclus::Error& e) {
-    NatUConverter nc(FeedAssay(), tails_assay);
     std::stringstream ss;
     ss << " tried to remove " << feed_req << " from its inventory of size "
-       << inventory.quantity()
-       << " and the conversion of the material into natu is "
-       << nc.convert(mat);
+       << inventory.quantity() << " for " << mats.size()
+       << " enrichments requiring " << natu_req << " of natu";
     throw cyclus::ValueError(Agent::InformErrorMsg(ss.str()));
   }
-
-  // "enrich" it, but pull out the composition and quantity we require from the
-  // blob
-  cyclus::Composition::Ptr comp = mat->comp();
-  Material::Ptr response = r->ExtractComp(qty, comp);
-  tails.Push(r);
+  UpdateFeed_(r, -1);
+
+  // "enrich" it, but pull out the composition and quantity each trade
+  // requires from the blob
+  std::vector<Material::Ptr> responses;
+  responses.reserve(mats.size());
+  for (int i = 0; i < mats.size(); i++) {
+    responses.push_back(r->ExtractComp(qtys[i], mats[i]->comp()));
+  }
+  double tails_qty = r->quantity();
+  PushTails_(r);
 
   current_swu_capacity -= swu_req;
 
   intra_timestep_swu_ += swu_req;
   intra_timestep_feed_ += feed_req;
-  RecordEnrichment_(feed_req, swu_req);
+  AllocateCascades_(feed_req, swu_req, tails_assay_used);
 
-  LOG(cyclus::LEV_INFO5, "EnrFac") << prototype()
-                                   << " has performed an enrichment: ";
+  LOG(cyclus::LEV_INFO5, "EnrFac") << prototype() << " has performed "
+                                   << mats.size() << " enrichments: ";
   LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Feed Qty: " << feed_req;
-  LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Feed Assay: "
-                                   << assays.Feed() * 100;
-  LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Product Qty: " << qty;
-  LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Product Assay: "
-                                   << assays.Product() * 100;
-  LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Tails Qty: "
-                                   << TailsQty(qty, assays);
+  LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Feed Assay: " << feed_assay * 100;
+  LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Product Qty: " << product_qty;
+  LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Tails Qty: " << tails_qty;
   LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Tails Assay: "
-                                   << assays.Tails() * 100;
+                                   << tails_assay_used * 100;
   LOG(cyclus::LEV_INFO5, "EnrFac") << "   * SWU: " << swu_req;
   LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Current SWU capacity: "
                                    << current_swu_capacity;
 
-  return response;
+  return responses;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-void Enrichment::RecordEnrichment_(double natural_u, double swu) {
+void Enrichment::PushTails_(Material::Ptr mat) {
+  if (tails.empty()) {
+    tails.Push(mat);
+    return;
+  }
+  // merge into the front tails material to keep the buffer size bounded
+  Material::Ptr front = tails.Pop();
+  front->Absorb(mat);
+  tails.Push(front);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Enrichment::AllocateCascades_(double natural_u, double swu,
+                                   double tails) {
+  int n = cascade_swu_capacities.size();
+  if (n == 0 || swu <= 0) {
+    RecordEnrichment_(natural_u, swu, tails, 0);
+    return;
+  }
+  if (cascade_swu_used_.size() != n) {
+    cascade_swu_used_.assign(n, 0);
+  }
+
+  double left = swu;
+  for (int i = 0; i < n && left > 0; i++) {
+    // anything beyond the total capacity (i.e. round-off) goes to the last
+    double take = left;
+    if (i < n - 1) {
+      take = std::min(left, cascade_swu_capacities[i] - cascade_swu_used_[i]);
+      if (take <= 0) {
+        continue;
+      }
+    }
+    cascade_swu_used_[i] += take;
+    left -= take;
+    RecordEnrichment_(natural_u * take / swu, take, tails, i);
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Enrichment::RecordEnrichment_(double natural_u, double swu, double tails,
+                                   int cascade) {
   using cyclus::Context;
   using cyclus::Agent;
 
@@ -444,6 +753,8 @@ void Enrichment::RecordEnrichment_(double natural_u, double swu) {
       ->AddVal("Time", ctx->time())
       ->AddVal("Natural_Uranium", natural_u)
       ->AddVal("SWU", swu)
+      ->AddVal("Tails_Assay", tails)
+      ->AddVal("Cascade", cascade)
       ->Record();
 }
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -451,11 +762,174 @@ double Enrichment::FeedAssay() {
   if (inventory.empty()) {
     return 0;
   }
-  double pop_qty = inventory.quantity();
-  Material::Ptr fission_matl =
-      inventory.Pop(pop_qty, cyclus::eps_rsrc());
-  inventory.Push(fission_matl);
-  return cyclus::toolkit::UraniumAssayMass(fission_matl);
+  IndexFeed_();
+  return feed_u235_ / (feed_u235_ + feed_u238_);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double Enrichment::FeedNatUFrac_() {
+  if (inventory.empty()) {
+    return 0;
+  }
+  IndexFeed_();
+  return (feed_u235_ + feed_u238_) / inventory.quantity();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Enrichment::IndexFeed_() {
+  if (feed_indexed_) {
+    return;
+  }
+
+  feed_u235_ = 0;
+  feed_u238_ = 0;
+  feed_indexed_ = true;
+  cyclus::toolkit::MatVec mats = inventory.PopN(inventory.count());
+  inventory.Push(mats);
+  for (int i = 0; i < mats.size(); i++) {
+    UpdateFeed_(mats[i], 1);
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Enrichment::UpdateFeed_(Material::Ptr mat, double sign) {
+  if (!feed_indexed_) {
+    return;
+  }
+  if (inventory.empty()) {
+    // avoids accumulating round-off once everything has been popped
+    feed_u235_ = 0;
+    feed_u238_ = 0;
+    return;
+  }
+
+  cyclus::toolkit::MatQuery mq(mat);
+  feed_u235_ += sign * mq.mass(922350000);
+  feed_u238_ += sign * mq.mass(922380000);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double OptimalTailsAssay(double feed, double feed_cost, double swu_cost) {
+  using cyclus::toolkit::ValueFunc;
+
+  // With F = (x_p - x_t) / (x_f - x_t) kg of feed per kg of product, the cost
+  // feed_cost * F + swu_cost * SWU is minimized where
+  //
+  //     g(x_t) = feed_cost + swu_cost * ((x_f - x_t) V'(x_t) + V(x_t) - V(x_f))
+  //
+  // is zero. g increases monotonically from -inf at x_t = 0 to feed_cost at
+  // x_t = x_f, so the root is unique and bracketed by (0, x_f).
+  if (feed <= 0 || feed >= 1) {
+    return 0;
+  }
+  double v_feed = ValueFunc(feed);
+  double lo = 0;
+  double hi = feed;
+  double x = feed / 2;
+  for (int i = 0; i < 100; i++) {
+    double dv = -2 * std::log((1 - x) / x) - (1 - 2 * x) / (x * (1 - x));
+    double g = feed_cost + swu_cost * ((feed - x) * dv + ValueFunc(x) - v_feed);
+    if (g < 0) {
+      lo = x;
+    } else {
+      hi = x;
+    }
+    double dg = swu_cost * (feed - x) / (x * x * (1 - x) * (1 - x));
+    double next = x - g / dg;
+    if (next <= lo || next >= hi) {
+      next = (lo + hi) / 2;
+    }
+    if (std::abs(next - x) <= 1e-14 * feed) {
+      return next;
+    }
+    x = next;
+  }
+  return x;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// Returns the feed and SWU needed to make qtys of product at assays.
+static void FeedAndSwu(double feed, double tails,
+                       const std::vector<double>& assays,
+                       const std::vector<double>& qtys, double* feed_qty,
+                       double* swu) {
+  using cyclus::toolkit::Assays;
+  *feed_qty = 0;
+  *swu = 0;
+  for (int i = 0; i < assays.size(); i++) {
+    Assays a(feed, assays[i], tails);
+    *feed_qty += cyclus::toolkit::FeedQty(qtys[i], a);
+    *swu += cyclus::toolkit::SwuRequired(qtys[i], a);
+  }
+}
+
+// Narrows [*lo, *hi] around the root of g, which increases over the interval
+// and is negative at *lo and non-negative at *hi.
+template <class G>
+static void Bisect(G g, double* lo, double* hi) {
+  for (int i = 0; i < 100 && *hi - *lo > 1e-14 * *hi; i++) {
+    double mid = (*lo + *hi) / 2;
+    if (g(mid) < 0) {
+      *lo = mid;
+    } else {
+      *hi = mid;
+    }
+  }
+}
+
+double ConstrainTailsAssay(double tails, double feed,
+                           const std::vector<double>& assays,
+                           const std::vector<double>& qtys,
+                           double feed_avail, double swu_avail) {
+  if (assays.empty() || feed_avail <= 0 || swu_avail <= 0 || feed <= 0 ||
+      feed >= 1) {
+    return tails;
+  }
+
+  // feed use rises and SWU use falls with the tails assay, so the feed limit
+  // caps it from above and the SWU limit from below
+  double f;
+  double s;
+  FeedAndSwu(feed, tails, assays, qtys, &f, &s);
+  bool feed_short = f > feed_avail;
+  bool swu_short = s > swu_avail;
+  if (!feed_short && !swu_short) {
+    return tails;
+  }
+
+  double lo = feed * 1e-6;
+  double hi = feed * (1 - 1e-6);
+  if (feed_short) {
+    double x_lo = lo;
+    double x_hi = tails;
+    Bisect([&](double x) {
+      FeedAndSwu(feed, x, assays, qtys, &f, &s);
+      return f - feed_avail;
+    }, &x_lo, &x_hi);
+    FeedAndSwu(feed, x_lo, assays, qtys, &f, &s);
+    if (f <= feed_avail && s <= swu_avail) {
+      return x_lo;
+    }
+  } else {
+    double x_lo = tails;
+    double x_hi = hi;
+    Bisect([&](double x) {
+      FeedAndSwu(feed, x, assays, qtys, &f, &s);
+      return swu_avail - s;
+    }, &x_lo, &x_hi);
+    FeedAndSwu(feed, x_hi, assays, qtys, &f, &s);
+    if (f <= feed_avail && s <= swu_avail) {
+      return x_hi;
+    }
+  }
+
+  // both limits cannot be met at once, so make as much product as possible,
+  // i.e. run out of feed and SWU together
+  Bisect([&](double x) {
+    FeedAndSwu(feed, x, assays, qtys, &f, &s);
+    return f / feed_avail - s / swu_avail;
+  }, &lo, &hi);
+  return (lo + hi) / 2;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
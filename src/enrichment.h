@@ -2,6 +2,8 @@
 #define CYCAMORE_SRC_ENRICHMENT_H_
 
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "cyclus.h"
 #include "cycamore_version.h"
@@ -10,14 +12,59 @@
 
 namespace cycamore {
 
+/// @class EnrichmentBatch
+///
+/// @brief The EnrichmentBatch holds the SWU and natural uranium required per
+/// kg of product for all product offers of an Enrichment facility in a time
+/// step.  The product assays of all offers are gathered into contiguous arrays
+/// and the requirements are computed for all of them in a single pass, so the
+/// exchange converters and Enrich_ only need a lookup and a multiplication per
+/// offer.
+class EnrichmentBatch {
+ public:
+  typedef boost::shared_ptr<EnrichmentBatch> Ptr;
+
+  EnrichmentBatch(double feed, double tails) : feed_(feed), tails_(tails) {}
+
+  /// @brief adds a product offer with the given U-235 mass assay.  Offers
+  /// must contain only U-235 and U-238.
+  void Add(cyclus::Material::Ptr offer, double assay);
+
+  /// @brief computes the SWU and feed per kg of product for all offers
+  void Compute();
+
+  /// @return the row of the given offer or -1 if it is not in the batch
+  inline int row(const cyclus::Material* offer) const {
+    std::unordered_map<const cyclus::Material*, int>::const_iterator it =
+        rows_.find(offer);
+    return it == rows_.end() ? -1 : it->second;
+  }
+
+  inline double feed() const { return feed_; }
+  inline double tails() const { return tails_; }
+  inline double assay(int row) const { return assays_[row]; }
+  inline double swu_per_kg(int row) const { return swu_per_kg_[row]; }
+  inline double feed_per_kg(int row) const { return feed_per_kg_[row]; }
+
+ private:
+  double feed_, tails_;
+  // offers are kept alive so that their addresses stay unique
+  std::vector<cyclus::Material::Ptr> offers_;
+  std::unordered_map<const cyclus::Material*, int> rows_;
+  std::vector<double> assays_;
+  std::vector<double> swu_per_kg_;
+  std::vector<double> feed_per_kg_;
+};
+
 /// @class SWUConverter
 ///
 /// @brief The SWUConverter is a simple Converter class for material to
 /// determine the amount of SWU required for their proposed enrichment
 class SWUConverter : public cyclus::Converter<cyclus::Material> {
  public:
-  SWUConverter(double feed_commod, double tails) : feed_(feed_commod),
-    tails_(tails) {}
+  SWUConverter(double feed_commod, double tails,
+               EnrichmentBatch::Ptr batch = EnrichmentBatch::Ptr())
+    : feed_(feed_commod), tails_(tails), batch_(batch) {}
   virtual ~SWUConverter() {}
 
   /// @brief provides a conversion for the SWU required
@@ -26,6 +73,10 @@ class SWUConverter : public cyclus::Converter<cyclus::Material> {
       cyclus::Arc const * a = NULL,
       cyclus::ExchangeTranslationContext<cyclus::Material>
           const * ctx = NULL) const {
+    int row = batch_ ? batch_->row(m.get()) : -1;
+    if (row >= 0) {
+      return batch_->swu_per_kg(row) * m->quantity();
+    }
     cyclus::toolkit::Assays assays(feed_, cyclus::toolkit::UraniumAssayMass(m),
                                    tails_);
     return cyclus::toolkit::SwuRequired(m->quantity(), assays);
@@ -41,6 +92,7 @@ class SWUConverter : public cyclus::Converter<cyclus::Material> {
 
  private:
   double feed_, tails_;
+  EnrichmentBatch::Ptr batch_;
 };
 
 /// @class NatUConverter
@@ -50,8 +102,9 @@ class SWUConverter : public cyclus::Converter<cyclus::Material> {
 /// enrichment
 class NatUConverter : public cyclus::Converter<cyclus::Material> {
  public:
-  NatUConverter(double feed_commod, double tails) : feed_(feed_commod),
-    tails_(tails) {}
+  NatUConverter(double feed_commod, double tails,
+                EnrichmentBatch::Ptr batch = EnrichmentBatch::Ptr())
+    : feed_(feed_commod), tails_(tails), batch_(batch) {}
   virtual ~NatUConverter() {}
 
   virtual std::string version() { return CYCAMORE_VERSION; }
@@ -62,6 +115,11 @@ class NatUConverter : public cyclus::Converter<cyclus::Material> {
       cyclus::Arc const * a = NULL,
       cyclus::ExchangeTranslationContext<cyclus::Material>
           const * ctx = NULL) const {
+    // batch offers are pure U-235/U-238, i.e. their natu fraction is 1
+    int row = batch_ ? batch_->row(m.get()) : -1;
+    if (row >= 0) {
+      return batch_->feed_per_kg(row) * m->quantity();
+    }
     cyclus::toolkit::Assays assays(feed_, cyclus::toolkit::UraniumAssayMass(m),
                                    tails_);
     cyclus::toolkit::MatQuery mq(m);
@@ -84,6 +142,7 @@ class NatUConverter : public cyclus::Converter<cyclus::Material> {
 
  private:
   double feed_, tails_;
+  EnrichmentBatch::Ptr batch_;
 };
 
 ///  The Enrichment facility is a simple Agent that enriches natural
@@ -116,8 +175,9 @@ class NatUConverter : public cyclus::Converter<cyclus::Material> {
 ///  fulfilled.
 ///
 ///  The Enrichment facility also offers its tails as an output commodity with
-///  no associated recipe.  Bids for tails are constrained only by total
-///  tails inventory.
+///  no associated recipe.  Tails from all enrichments are merged into a single
+///  material and offered as one bid per request.  Bids for tails are
+///  constrained only by total tails inventory.
 
 class Enrichment
   : public cyclus::Facility,
@@ -250,6 +310,14 @@ class Enrichment
     return tails;
   }
 
+  /// @return the number of feed deliveries with isotopes other than U-235
+  /// and U-238 that were not warned about because their composition had
+  /// already been warned about.  The count for each time step is also
+  /// recorded to the EnrichmentFeedWarnings table.
+  inline int SuppressedFeedWarnings() const {
+    return suppressed_feed_warnings_;
+  }
+
  private:
   // Code Injection:
   #include "toolkit/position.cycpp.h"
@@ -270,13 +338,65 @@ class Enrichment
   ///  @param req the requested material being responded to
   cyclus::Material::Ptr Offer_(cyclus::Material::Ptr req);
 
+  ///  @brief returns the U-235/U-238 offer composition for a requested
+  ///  composition.  Offer compositions are shared by all requests with the
+  ///  same composition or with U-235 atom fractions within
+  ///  kOfferAssayTol of each other.
+  cyclus::Composition::Ptr OfferComp_(cyclus::Composition::Ptr c);
+
   cyclus::Material::Ptr Enrich_(cyclus::Material::Ptr mat, double qty);
 
+  ///  @brief enriches all given materials together: the feed for all of them
+  ///  is popped from inventory at once, each product is extracted from it and
+  ///  the remainder becomes a single tails material.  The enrichment is
+  ///  recorded once (per cascade) for all products.
+  ///
+  ///  @param mats the requested product materials
+  ///  @param qtys the quantity of each product
+  ///  @return the products, in the order of mats
+  std::vector<cyclus::Material::Ptr> EnrichAll_(
+      const std::vector<cyclus::Material::Ptr>& mats,
+      const std::vector<double>& qtys);
+
+  ///  @brief adds tails to the tails buffer, merging them with the tails
+  ///  already held so the buffer holds a single material
+  void PushTails_(cyclus::Material::Ptr mat);
+
   ///  @brief calculates the feed assay based on the unenriched inventory
   double FeedAssay();
 
+  ///  @brief the mass fraction of the unenriched inventory that is U-235 or
+  ///  U-238, i.e. usable as natural uranium feed
+  double FeedNatUFrac_();
+
+  ///  @brief builds the running U-235/U-238 masses of the inventory if they
+  ///  are not yet known (e.g. on the first use after a restart)
+  void IndexFeed_();
+
+  ///  @brief adds (sign = 1) or removes (sign = -1) a material pushed to or
+  ///  popped from the inventory to/from the running U-235/U-238 masses
+  void UpdateFeed_(cyclus::Material::Ptr mat, double sign);
+
+  ///  @brief the tails assay used for enrichments in this time step
+  inline double TailsAssay_() const {
+    return optimize_tails ? current_tails_assay : tails_assay;
+  }
+
+  ///  @brief the SWU capacity at the given time, from the SWU capacity
+  ///  schedule if there is one
+  double SwuCapacityAt_(int time);
+
+  ///  @brief resolves the SWU capacity schedule into one capacity per time
+  ///  step of the simulation
+  void ScheduleSwu_();
+
+  ///  @brief splits an enrichment's SWU over the cascades, in order, up to
+  ///  their remaining capacity and records each part
+  void AllocateCascades_(double natural_u, double swu, double tails);
+
   ///  @brief records and enrichment with the cyclus::Recorder
-  void RecordEnrichment_(double natural_u, double swu);
+  void RecordEnrichment_(double natural_u, double swu, double tails,
+                         int cascade);
 
   #pragma cyclus var { \
     "tooltip": "feed commodity",					\
@@ -376,8 +496,91 @@ class Enrichment
   }
   double swu_capacity;
 
+  #pragma cyclus var { \
+    "default": [], \
+    "uilabel": "Cascade SWU Capacities", \
+    "units": "kgSWU/timestep", \
+    "doc": "SWU capacity of each cascade of the facility. If given, the " \
+           "facility's SWU capacity is the sum of the cascade capacities " \
+           "and swu_capacity must be left unset or equal to it. Each " \
+           "enrichment is assigned to the cascades in order, filling each " \
+           "cascade's capacity before moving to the next, and is recorded " \
+           "per cascade in the Enrichments table. All cascades run at the " \
+           "same tails assay; cascades only divide the facility's SWU " \
+           "between them and are not optimized separately.", \
+  }
+  std::vector<double> cascade_swu_capacities;
+
+  #pragma cyclus var { \
+    "default": [], \
+    "uilabel": "SWU Capacity Schedule Times", \
+    "doc": "Simulation time steps at which the SWU capacity changes to the " \
+           "corresponding value in swu_capacity_vals, in increasing order. " \
+           "Before the first time, swu_capacity is used. This allows one " \
+           "facility to model ramp-up, outages and added capacity.", \
+  }
+  std::vector<int> swu_capacity_times;
+
+  #pragma cyclus var { \
+    "default": [], \
+    "uilabel": "SWU Capacity Schedule Values", \
+    "units": "kgSWU/timestep", \
+    "doc": "SWU capacities taking effect at the corresponding times in " \
+           "swu_capacity_times.", \
+  }
+  std::vector<double> swu_capacity_vals;
+
+  #pragma cyclus var { \
+    "default": False, \
+    "uitype": "bool", \
+    "uilabel": "Ramp SWU Capacity", \
+    "doc": "If true, the SWU capacity changes linearly between consecutive " \
+           "points of the SWU capacity schedule instead of in steps.", \
+  }
+  bool swu_capacity_ramp;
+
+  #pragma cyclus var { \
+    "default": False, \
+    "uitype": "bool", \
+    "uilabel": "Optimize Tails Assay", \
+    "doc": "If true, the tails assay is chosen every time step to minimize " \
+           "the cost of feed plus SWU per kg of product for the current " \
+           "feed assay, using feed_cost and swu_cost, instead of using " \
+           "tails_assay. If the feed inventory or SWU capacity would not " \
+           "cover all product requests at that tails assay, the nearest " \
+           "tails assay that does is used, or failing that the one making " \
+           "the most product. The tails assay used is recorded in the " \
+           "Enrichments table.", \
+  }
+  bool optimize_tails;
+
+  #pragma cyclus var { \
+    "default": 1.0, \
+    "uilabel": "Feed Cost", \
+    "doc": "Cost of one kg of natural uranium feed, relative to swu_cost. " \
+           "Only used if optimize_tails is true.", \
+  }
+  double feed_cost;
+
+  #pragma cyclus var { \
+    "default": 1.0, \
+    "uilabel": "SWU Cost", \
+    "doc": "Cost of one kgSWU, relative to feed_cost. Only used if " \
+           "optimize_tails is true.", \
+  }
+  double swu_cost;
+
   double current_swu_capacity;
 
+  // tails assay chosen for this time step and SWU used from each cascade -
+  // set every time step and no need to persist
+  double current_tails_assay;
+  std::vector<double> cascade_swu_used_;
+
+  // SWU capacity at every time step of the simulation, resolved from the SWU
+  // capacity schedule - populated lazily and no need to persist
+  std::vector<double> swu_schedule_;
+
   #pragma cyclus var { 'capacity': 'max_feed_inventory' }
   cyclus::toolkit::ResBuf<cyclus::Material> inventory;  // natural u
   #pragma cyclus var {}
@@ -388,11 +591,63 @@ class Enrichment
   double intra_timestep_swu_;
   double intra_timestep_feed_;
 
+  // running U-235 and U-238 masses of the inventory, updated on every push and
+  // pop so the inventory never has to be squashed just to be inspected -
+  // rebuilt lazily and no need to persist
+  double feed_u235_;
+  double feed_u238_;
+  bool feed_indexed_;
+
+  // feed composition ids already checked for isotopes other than U-235 and
+  // U-238, mapped to the warnings they raised (1 for other U isotopes, 2 for
+  // other elements) - populated lazily and no need to persist
+  std::unordered_map<int, int> feed_comp_flags_;
+  int suppressed_feed_warnings_;
+  // suppressed warnings already recorded to EnrichmentFeedWarnings - no need
+  // to persist
+  int recorded_feed_warnings_;
+
+  // offer compositions keyed by requested composition id and by bucketed
+  // U-235 atom fraction - populated lazily and no need to persist
+  std::unordered_map<int, cyclus::Composition::Ptr> offer_comps_;
+  std::unordered_map<long long, cyclus::Composition::Ptr> offer_assays_;
+
+  // SWU and feed requirements of this time step's product offers, shared with
+  // the exchange converters - intra-time-step state, no need to persist
+  EnrichmentBatch::Ptr batch_;
+
   friend class EnrichmentTest;
+  friend class EnrichmentBench;
   // ---
 
 };
 
+/// Returns the tails assay that minimizes the cost of feed plus SWU per kg of
+/// product when enriching feed of the given assay.  The optimum does not depend
+/// on the product assay; it is the root of the derivative of the cost with
+/// respect to the tails assay, found with a safeguarded Newton iteration.
+/// @param feed the feed U-235 mass fraction
+/// @param feed_cost the cost per kg of feed
+/// @param swu_cost the cost per kgSWU
+double OptimalTailsAssay(double feed, double feed_cost, double swu_cost);
+
+/// Returns the tails assay nearest to tails at which enriching qtys kg of
+/// product at the U-235 mass fractions assays needs at most feed_avail kg of
+/// feed and swu_avail kgSWU.  Feed use rises and SWU use falls with the tails
+/// assay, so the limits bound it from above and below.  If no tails assay
+/// meets both limits, returns the one at which the most product can be made,
+/// where feed and SWU run out together.
+/// @param tails the preferred tails assay, e.g. from OptimalTailsAssay
+/// @param feed the feed U-235 mass fraction
+/// @param assays the product U-235 mass fractions
+/// @param qtys the product quantities, in kg
+/// @param feed_avail the feed available, in kg
+/// @param swu_avail the SWU available, in kgSWU
+double ConstrainTailsAssay(double tails, double feed,
+                           const std::vector<double>& assays,
+                           const std::vector<double>& qtys,
+                           double feed_avail, double swu_avail);
+
 }  // namespace cycamore
 
 #endif // CYCAMORE_SRC_ENRICHMENT_FACILITY_H_
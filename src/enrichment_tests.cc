@@ -298,9 +298,10 @@ TEST_F(EnrichmentTest, TradeTails) {
   QueryResult qr = sim.db().Query("Transactions", &conds);
   Material::Ptr m = sim.GetMaterial(qr.GetVal<int>("ResourceId"));
 
-  // Should be 2 tails transactions, one from each LEU sink, each 4.125kg.
+  // Tails from both LEU sinks, each 4.125kg, are merged and offered as a
+  // single bid, so there is one tails transaction.
   // Q * (e_p - e_f)/(e_f - e_t) = 0.5 * (0.04 - 0.007)/(0.007 - 0.003) = 4.125
-  EXPECT_EQ(2, qr.rows.size());
+  EXPECT_EQ(1, qr.rows.size());
 
   cyclus::SqlStatement::Ptr stmt = sim.db().db().Prepare(
       "SELECT SUM(r.Quantity) FROM Transactions AS t"
@@ -314,6 +315,281 @@ TEST_F(EnrichmentTest, TradeTails) {
     "Not providing the requested quantity" ;
 }
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(EnrichmentTest, BatchedEnrichments) {
+  // this tests that all product trades of a time step are enriched together
+  // and recorded as one enrichment
+
+  std::string config =
+    "   <feed_commod>natu</feed_commod> "
+    "   <feed_recipe>natu1</feed_recipe> "
+    "   <product_commod>enr_u</product_commod> "
+    "   <tails_commod>tails</tails_commod> "
+    "   <tails_assay>0.003</tails_assay> ";
+
+  int simdur = 2;
+  cyclus::MockSim sim(cyclus::AgentSpec
+          (":cycamore:Enrichment"), config, simdur);
+  sim.AddRecipe("natu1", c_natu1());
+  sim.AddRecipe("leu", c_leu());
+  sim.AddRecipe("heu", c_heu());
+
+  sim.AddSource("natu")
+    .recipe("natu1")
+    .Finalize();
+  sim.AddSink("enr_u")
+    .recipe("leu")
+    .capacity(0.5)
+    .Finalize();
+  sim.AddSink("enr_u")
+    .recipe("heu")
+    .capacity(0.5)
+    .Finalize();
+
+  int id = sim.Run();
+
+  std::vector<Cond> conds;
+  conds.push_back(Cond("Commodity", "==", std::string("enr_u")));
+  QueryResult qr = sim.db().Query("Transactions", &conds);
+  EXPECT_EQ(2, qr.rows.size());
+
+  // F = P * (e_p - e_t)/(e_f - e_t) for each product
+  // 0.5 * (0.04 - 0.003)/(0.007 - 0.003) + 0.5 * (0.2 - 0.003)/(0.007 - 0.003)
+  conds.clear();
+  conds.push_back(Cond("Time", "==", 1));
+  qr = sim.db().Query("Enrichments", &conds);
+  ASSERT_EQ(1, qr.rows.size());
+  EXPECT_NEAR(4.625 + 24.625, qr.GetVal<double>("Natural_Uranium"), 0.01);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(EnrichmentTest, Cascades) {
+  // this tests that enrichments are split over cascades in order and that the
+  // facility's SWU capacity is the sum of the cascade capacities
+
+  std::string config =
+    "   <feed_commod>natu</feed_commod> "
+    "   <feed_recipe>natu1</feed_recipe> "
+    "   <product_commod>enr_u</product_commod> "
+    "   <tails_commod>tails</tails_commod> "
+    "   <tails_assay>0.003</tails_assay> "
+    "   <cascade_swu_capacities> <val>2</val> <val>3</val> "
+    "   </cascade_swu_capacities> ";
+
+  int simdur = 2;
+  cyclus::MockSim sim(cyclus::AgentSpec
+          (":cycamore:Enrichment"), config, simdur);
+  sim.AddRecipe("natu1", c_natu1());
+  sim.AddRecipe("leu", c_leu());
+
+  sim.AddSource("natu")
+    .recipe("natu1")
+    .Finalize();
+  sim.AddSink("enr_u")
+    .recipe("leu")
+    .Finalize();
+
+  int id = sim.Run();
+
+  std::vector<Cond> conds;
+  conds.push_back(Cond("Time", "==", 1));
+  QueryResult qr = sim.db().Query("Enrichments", &conds);
+  ASSERT_EQ(2, qr.rows.size());
+  EXPECT_EQ(0, qr.GetVal<int>("Cascade", 0));
+  EXPECT_NEAR(2, qr.GetVal<double>("SWU", 0), 1e-3);
+  EXPECT_EQ(1, qr.GetVal<int>("Cascade", 1));
+  EXPECT_NEAR(3, qr.GetVal<double>("SWU", 1), 1e-3);
+  EXPECT_DOUBLE_EQ(0.003, qr.GetVal<double>("Tails_Assay", 0));
+
+  // a conflicting facility SWU capacity is rejected
+  cyclus::MockSim conflict(cyclus::AgentSpec(":cycamore:Enrichment"),
+      config + "<swu_capacity>100</swu_capacity>", simdur);
+  conflict.AddRecipe("natu1", c_natu1());
+  EXPECT_THROW(conflict.Run(), cyclus::ValueError);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(EnrichmentTest, SwuCapacitySchedule) {
+  // this tests that the SWU capacity follows its schedule, in steps or ramped
+
+  std::string config =
+    "   <feed_commod>natu</feed_commod> "
+    "   <feed_recipe>natu1</feed_recipe> "
+    "   <product_commod>enr_u</product_commod> "
+    "   <tails_commod>tails</tails_commod> "
+    "   <tails_assay>0.003</tails_assay> "
+    "   <swu_capacity>1</swu_capacity> "
+    "   <swu_capacity_times> <val>2</val> <val>4</val> </swu_capacity_times> "
+    "   <swu_capacity_vals> <val>3</val> <val>5</val> </swu_capacity_vals> ";
+
+  int simdur = 5;
+  double step[] = {1, 3, 3, 5};
+  double ramp[] = {1, 3, 4, 5};
+  for (int i = 0; i < 2; i++) {
+    std::string ramp_config = i == 0 ? "" :
+        "   <swu_capacity_ramp>1</swu_capacity_ramp> ";
+    cyclus::MockSim sim(cyclus::AgentSpec
+            (":cycamore:Enrichment"), config + ramp_config, simdur);
+    sim.AddRecipe("natu1", c_natu1());
+    sim.AddRecipe("leu", c_leu());
+    sim.AddSource("natu")
+      .recipe("natu1")
+      .Finalize();
+    sim.AddSink("enr_u")
+      .recipe("leu")
+      .Finalize();
+    int id = sim.Run();
+
+    for (int t = 1; t < simdur; t++) {
+      std::vector<Cond> conds;
+      conds.push_back(Cond("Time", "==", t));
+      QueryResult qr = sim.db().Query("Enrichments", &conds);
+      ASSERT_EQ(1, qr.rows.size());
+      EXPECT_NEAR(i == 0 ? step[t - 1] : ramp[t - 1],
+                  qr.GetVal<double>("SWU"), 1e-3) << "time " << t;
+    }
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST(EnrichmentFunctionTests, OptimalTailsAssay) {
+  using cyclus::toolkit::Assays;
+  using cyclus::toolkit::FeedQty;
+  using cyclus::toolkit::SwuRequired;
+
+  double feed = 0.00711;
+  double product = 0.045;
+  double feed_cost = 100;
+  double swu_cost = 150;
+  double tails = OptimalTailsAssay(feed, feed_cost, swu_cost);
+  EXPECT_LT(0.001, tails);
+  EXPECT_GT(feed, tails);
+
+  // the cost per kg of product is minimal at the optimum, for any product
+  double prods[] = {product, 0.2};
+  for (int i = 0; i < 2; i++) {
+    double cost[3];
+    double xt[] = {tails * 0.99, tails, tails * 1.01};
+    for (int j = 0; j < 3; j++) {
+      Assays a(feed, prods[i], xt[j]);
+      cost[j] = feed_cost * FeedQty(1, a) + swu_cost * SwuRequired(1, a);
+    }
+    EXPECT_LT(cost[1], cost[0]);
+    EXPECT_LT(cost[1], cost[2]);
+  }
+
+  // more expensive SWU means less SWU, i.e. a higher tails assay
+  EXPECT_LT(tails, OptimalTailsAssay(feed, feed_cost, swu_cost * 2));
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST(EnrichmentFunctionTests, ConstrainTailsAssay) {
+  using cyclus::toolkit::Assays;
+  using cyclus::toolkit::FeedQty;
+  using cyclus::toolkit::SwuRequired;
+
+  double feed = 0.00711;
+  double tails = 0.0025;
+  std::vector<double> assays(1, 0.045);
+  std::vector<double> qtys(1, 10);
+  Assays a(feed, assays[0], tails);
+  double f = FeedQty(qtys[0], a);
+  double s = SwuRequired(qtys[0], a);
+
+  // enough of both leaves the tails assay alone
+  EXPECT_DOUBLE_EQ(tails, ConstrainTailsAssay(tails, feed, assays, qtys,
+                                              f, s));
+
+  // short of feed lowers it until the feed suffices
+  double got = ConstrainTailsAssay(tails, feed, assays, qtys, f * 0.9, s * 2);
+  EXPECT_GT(tails, got);
+  EXPECT_NEAR(f * 0.9, FeedQty(qtys[0], Assays(feed, assays[0], got)), 1e-6);
+
+  // short of SWU raises it until the SWU suffices
+  got = ConstrainTailsAssay(tails, feed, assays, qtys, f * 2, s * 0.9);
+  EXPECT_LT(tails, got);
+  EXPECT_NEAR(s * 0.9, SwuRequired(qtys[0], Assays(feed, assays[0], got)),
+              1e-6);
+
+  // short of both runs out of feed and SWU together
+  got = ConstrainTailsAssay(tails, feed, assays, qtys, f * 0.5, s * 0.5);
+  Assays b(feed, assays[0], got);
+  EXPECT_NEAR(FeedQty(1, b) / (f * 0.5), SwuRequired(1, b) / (s * 0.5),
+              1e-6);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(EnrichmentTest, OptimizeTails) {
+  // this tests that a facility optimizing its tails assay enriches at the
+  // optimum, and below it when its feed inventory is short
+  using cyclus::toolkit::Assays;
+  using cyclus::toolkit::FeedQty;
+
+  std::string config =
+    "   <feed_commod>natu</feed_commod> "
+    "   <feed_recipe>natu1</feed_recipe> "
+    "   <product_commod>enr_u</product_commod> "
+    "   <tails_commod>tails</tails_commod> "
+    "   <tails_assay>0.003</tails_assay> "
+    "   <optimize_tails>1</optimize_tails> "
+    "   <feed_cost>100</feed_cost> "
+    "   <swu_cost>150</swu_cost> ";
+
+  double optimum = OptimalTailsAssay(0.007, 100, 150);
+  double product = 10;
+  double feed = FeedQty(product, Assays(0.007, 0.04, optimum));
+
+  int simdur = 2;
+  for (int i = 0; i < 2; i++) {
+    double feed_inv = i == 0 ? 10 * feed : 0.9 * feed;
+    std::stringstream inv;
+    inv << "<max_feed_inventory>" << feed_inv << "</max_feed_inventory>";
+    cyclus::MockSim sim(cyclus::AgentSpec
+            (":cycamore:Enrichment"), config + inv.str(), simdur);
+    sim.AddRecipe("natu1", c_natu1());
+    sim.AddRecipe("leu", c_leu());
+    sim.AddSource("natu")
+      .recipe("natu1")
+      .Finalize();
+    sim.AddSink("enr_u")
+      .recipe("leu")
+      .capacity(product)
+      .Finalize();
+    int id = sim.Run();
+
+    std::vector<Cond> conds;
+    conds.push_back(Cond("Time", "==", 1));
+    QueryResult qr = sim.db().Query("Enrichments", &conds);
+    ASSERT_EQ(1, qr.rows.size());
+    double tails = qr.GetVal<double>("Tails_Assay");
+    if (i == 0) {
+      EXPECT_NEAR(optimum, tails, 1e-9) << "tails assay not optimal";
+      EXPECT_NEAR(feed, qr.GetVal<double>("Natural_Uranium"), 1e-6);
+    } else {
+      EXPECT_GT(optimum, tails) << "short feed did not lower the tails assay";
+      EXPECT_NEAR(feed_inv, qr.GetVal<double>("Natural_Uranium"), 1e-6)
+          << "feed not limited to the inventory";
+    }
+
+    // the whole request is still met
+    conds.push_back(Cond("Commodity", "==", std::string("enr_u")));
+    qr = sim.db().Query("Transactions", &conds);
+    ASSERT_EQ(1, qr.rows.size());
+    Material::Ptr m = sim.GetMaterial(qr.GetVal<int>("ResourceId"));
+    EXPECT_NEAR(product, m->quantity(), 1e-6);
+  }
+
+  // a facility SWU capacity equal to the cascade total is accepted
+  std::string cascades =
+    "   <swu_capacity>5</swu_capacity> "
+    "   <cascade_swu_capacities> <val>2</val> <val>3</val> "
+    "   </cascade_swu_capacities> ";
+  cyclus::MockSim consistent(cyclus::AgentSpec(":cycamore:Enrichment"),
+      config + cascades, simdur);
+  consistent.AddRecipe("natu1", c_natu1());
+  EXPECT_NO_THROW(consistent.Run());
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 TEST_F(EnrichmentTest, BidPrefs) {
   // This tests that natu sources are preference-ordered by
@@ -517,6 +793,11 @@ EnrichmentTest::DoEnrich(Material::Ptr mat, double qty) {
   return src_facility->Enrich_(mat, qty);
 }
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double EnrichmentTest::DoFeedAssay() {
+  return src_facility->FeedAssay();
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 TEST_F(EnrichmentTest, Request) {
   // Tests that quantity in material request is accurate
@@ -602,6 +883,123 @@ TEST_F(EnrichmentTest, ValidReq) {
   EXPECT_NEAR(natuc.convert(target) * mass_frac, natuc.convert(offer), 0.001);
 }
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(EnrichmentTest, FeedWarnings) {
+  // feed with isotopes other than U-235 and U-238 is only warned about once
+  // per composition
+  CompMap v;
+  v[922340000] = 0.001;
+  v[922350000] = 0.007;
+  v[922380000] = 0.992;
+  cyclus::Composition::Ptr c = cyclus::Composition::CreateFromMass(v);
+
+  src_facility->SetMaxInventorySize(10);
+  DoAddMat(Material::CreateUntracked(1, c));
+  EXPECT_EQ(0, src_facility->SuppressedFeedWarnings());
+  DoAddMat(Material::CreateUntracked(1, c));
+  DoAddMat(Material::CreateUntracked(1, c));
+  EXPECT_EQ(2, src_facility->SuppressedFeedWarnings());
+
+  // pure uranium feed is never counted
+  DoAddMat(GetMat(1));
+  DoAddMat(GetMat(1));
+  EXPECT_EQ(2, src_facility->SuppressedFeedWarnings());
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(EnrichmentTest, RecordFeedWarnings) {
+  // suppressed feed warnings are recorded for each time step they occur in
+  std::string config =
+    "   <feed_commod>natu</feed_commod> "
+    "   <feed_recipe>natu1</feed_recipe> "
+    "   <product_commod>enr_u</product_commod> "
+    "   <tails_commod>tails</tails_commod> "
+    "   <tails_assay>0.003</tails_assay> ";
+
+  CompMap v;
+  v[922340000] = 0.001;
+  v[922350000] = 0.007;
+  v[922380000] = 0.992;
+
+  int simdur = 3;
+  cyclus::MockSim sim(cyclus::AgentSpec
+          (":cycamore:Enrichment"), config, simdur);
+  sim.AddRecipe("natu1", c_natu1());
+  sim.AddRecipe("natu234", cyclus::Composition::CreateFromMass(v));
+  sim.AddSource("natu")
+    .recipe("natu234")
+    .capacity(1)
+    .Finalize();
+  int id = sim.Run();
+
+  // the first delivery is warned about, the later ones are suppressed
+  QueryResult qr = sim.db().Query("EnrichmentFeedWarnings", NULL);
+  ASSERT_EQ(2, qr.rows.size());
+  for (int i = 0; i < qr.rows.size(); i++) {
+    EXPECT_EQ(1, qr.GetVal<int>("Suppressed", i));
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(EnrichmentTest, SharedOfferComps) {
+  // offers for requests with the same U-235/U-238 ratio share a composition
+  CompMap v;
+  v[922350000] = 0.04;
+  v[922380000] = 0.96;
+  v[942390000] = 0.01;
+  Material::Ptr o1 = DoOffer(Material::CreateUntracked(1, c_leu()));
+  Material::Ptr o2 = DoOffer(Material::CreateUntracked(2, c_leu()));
+  Material::Ptr o3 = DoOffer(Material::CreateUntracked(
+      3, cyclus::Composition::CreateFromMass(v)));
+  Material::Ptr o4 = DoOffer(Material::CreateUntracked(1, c_heu()));
+
+  EXPECT_EQ(o1->comp(), o2->comp());
+  EXPECT_EQ(o1->comp(), o3->comp());
+  EXPECT_NE(o1->comp(), o4->comp());
+  EXPECT_EQ(3, o3->quantity());
+
+  cyclus::toolkit::MatQuery mq(o4);
+  EXPECT_NEAR(0.2, mq.mass_frac(922350000), 1e-10);
+  EXPECT_NEAR(0.8, mq.mass_frac(922380000), 1e-10);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(EnrichmentTest, BatchConverters) {
+  // converters reading a precomputed batch must agree with the per material
+  // calculation for offers in the batch
+  using cyclus::toolkit::UraniumAssayMass;
+
+  EnrichmentBatch::Ptr batch(new EnrichmentBatch(feed_assay, tails_assay));
+  std::vector<Material::Ptr> offers;
+  double assays[] = {0.01, 0.035, 0.05, 0.2, 0.9};
+  for (int i = 0; i < 5; i++) {
+    CompMap v;
+    v[922350000] = assays[i];
+    v[922380000] = 1 - assays[i];
+    Material::Ptr offer = DoOffer(Material::CreateUntracked(
+        i + 1, cyclus::Composition::CreateFromMass(v)));
+    batch->Add(offer, UraniumAssayMass(offer));
+    offers.push_back(offer);
+  }
+  batch->Compute();
+
+  SWUConverter swuc(feed_assay, tails_assay);
+  NatUConverter natuc(feed_assay, tails_assay);
+  SWUConverter batch_swuc(feed_assay, tails_assay, batch);
+  NatUConverter batch_natuc(feed_assay, tails_assay, batch);
+  for (int i = 0; i < offers.size(); i++) {
+    EXPECT_EQ(i, batch->row(offers[i].get()));
+    EXPECT_NEAR(swuc.convert(offers[i]), batch_swuc.convert(offers[i]), 1e-9);
+    EXPECT_NEAR(natuc.convert(offers[i]), batch_natuc.convert(offers[i]),
+                1e-9);
+  }
+
+  // materials not in the batch fall back to the per material calculation
+  Material::Ptr other = GetMat(3);
+  EXPECT_EQ(-1, batch->row(other.get()));
+  EXPECT_DOUBLE_EQ(swuc.convert(other), batch_swuc.convert(other));
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 TEST_F(EnrichmentTest, Enrich) {
   // this test asks the facility to enrich a material that results in an amount
@@ -649,6 +1047,37 @@ TEST_F(EnrichmentTest, Enrich) {
   EXPECT_THROW(response = DoEnrich(target, qty), cyclus::Error);
 }
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(EnrichmentTest, FeedAssay) {
+  // the feed assay of an inventory of several feed materials must match that
+  // of the same materials squashed together, before and after enrichments
+  using cyclus::toolkit::Squash;
+  using cyclus::toolkit::UraniumAssayMass;
+
+  EXPECT_EQ(0, DoFeedAssay());
+
+  src_facility->SetMaxInventorySize(10);
+  Material::Ptr m1 = GetMat(2);
+  Material::Ptr m2 = Material::CreateUntracked(3, c_natu2());
+  Material::Ptr m3 = Material::CreateUntracked(1, c_heu());
+  DoAddMat(m1->Clone());
+  DoAddMat(m2->Clone());
+  cyclus::toolkit::MatVec mats;
+  mats.push_back(m1->Clone());
+  mats.push_back(m2->Clone());
+  EXPECT_NEAR(UraniumAssayMass(Squash(mats)), DoFeedAssay(), 1e-10);
+
+  DoAddMat(m3->Clone());
+  mats.push_back(m3->Clone());
+  EXPECT_NEAR(UraniumAssayMass(Squash(mats)), DoFeedAssay(), 1e-10);
+
+  // enriching pops the front of the inventory
+  double assay = DoFeedAssay();
+  DoEnrich(Material::CreateUntracked(1, c_leu()), 0.1);
+  EXPECT_NE(assay, DoFeedAssay());
+  EXPECT_LT(0, DoFeedAssay());
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 TEST_F(EnrichmentTest, Response) {
   // this test asks the facility to respond to multiple requests for enriched
@@ -1,6 +1,9 @@
 #include "fuel_fab.h"
 
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <unordered_map>
 
 using cyclus::Material;
 using cyclus::Composition;
@@ -15,7 +18,7 @@ namespace cycamore {
 class FissConverter : public cyclus::Converter<Material> {
  public:
   FissConverter(Composition::Ptr c_fill, Composition::Ptr c_fiss,
-                Composition::Ptr c_topup, std::string spectrum)
+                Composition::Ptr c_topup, Spectrum spectrum)
       : c_fiss_(c_fiss), c_topup_(c_topup), c_fill_(c_fill), spec_(spectrum) {
     w_fiss_ = CosiWeight(c_fiss, spectrum);
     w_fill_ = CosiWeight(c_fill, spectrum);
@@ -43,7 +46,7 @@ class FissConverter : public cyclus::Converter<Material> {
   }
 
  private:
-  std::string spec_;
+  Spectrum spec_;
   double w_fiss_;
   double w_topup_;
   double w_fill_;
@@ -55,7 +58,7 @@ class FissConverter : public cyclus::Converter<Material> {
 class FillConverter : public cyclus::Converter<Material> {
  public:
   FillConverter(Composition::Ptr c_fill, Composition::Ptr c_fiss,
-                Composition::Ptr c_topup, std::string spectrum)
+                Composition::Ptr c_topup, Spectrum spectrum)
       : c_fiss_(c_fiss), c_topup_(c_topup), c_fill_(c_fill), spec_(spectrum) {
     w_fiss_ = CosiWeight(c_fiss, spectrum);
     w_fill_ = CosiWeight(c_fill, spectrum);
@@ -82,7 +85,7 @@ class FillConverter : public cyclus::Converter<Material> {
   }
 
  private:
-  std::string spec_;
+  Spectrum spec_;
   double w_fiss_;
   double w_topup_;
   double w_fill_;
@@ -94,7 +97,7 @@ class FillConverter : public cyclus::Converter<Material> {
 class TopupConverter : public cyclus::Converter<Material> {
  public:
   TopupConverter(Composition::Ptr c_fill, Composition::Ptr c_fiss,
-                 Composition::Ptr c_topup, std::string spectrum)
+                 Composition::Ptr c_topup, Spectrum spectrum)
       : c_fiss_(c_fiss), c_topup_(c_topup), c_fill_(c_fill), spec_(spectrum) {
     w_fiss_ = CosiWeight(c_fiss, spectrum);
     w_fill_ = CosiWeight(c_fill, spectrum);
@@ -121,7 +124,7 @@ class TopupConverter : public cyclus::Converter<Material> {
   }
 
  private:
-  std::string spec_;
+  Spectrum spec_;
   double w_fiss_;
   double w_topup_;
   double w_fill_;
@@ -130,11 +133,40 @@ class TopupConverter : public cyclus::Converter<Material> {
   Composition::Ptr c_topup_;
 };
 
+// Converts a lot blend offered by FuelFab into the quantity of one input lot
+// it uses.
+class LotConverter : public cyclus::Converter<Material> {
+ public:
+  LotConverter(boost::shared_ptr<BlendFracs> fracs, int lot)
+      : fracs_(fracs), lot_(lot) {}
+
+  virtual ~LotConverter() {}
+
+  virtual double convert(
+      Material::Ptr m, cyclus::Arc const* a = NULL,
+      cyclus::ExchangeTranslationContext<Material> const* ctx =
+          NULL) const {
+    BlendFracs::const_iterator it = fracs_->find(m.get());
+    if (it == fracs_->end()) {
+      return 0;
+    }
+    return it->second[lot_] * m->quantity();
+  }
+
+ private:
+  boost::shared_ptr<BlendFracs> fracs_;
+  int lot_;
+};
+
+static double MeanAtomicMass(Composition::Ptr c);
+
 FuelFab::FuelFab(cyclus::Context* ctx)
     : cyclus::Facility(ctx),
       fill_size(0),
       fiss_size(0),
-      throughput(0) {}
+      throughput(0),
+      spec_(THERMAL),
+      lots_indexed_(false) {}
 
 void FuelFab::EnterNotify() {
   cyclus::Facility::EnterNotify();
@@ -161,6 +193,8 @@ void FuelFab::EnterNotify() {
     throw cyclus::ValidationError(ss.str());
   }
 
+  spec_ = SpectrumFromName(spectrum);
+
   InitializePosition();
 }
 
@@ -243,24 +277,38 @@ void FuelFab::AcceptMatlTrades(
   std::vector<std::pair<cyclus::Trade<Material>,
                         Material::Ptr> >::const_iterator trade;
 
+  bool track_lots = keep_lots && !blend_lots;
+  if (track_lots) {
+    IndexLots_();
+  }
+
   for (trade = responses.begin(); trade != responses.end(); ++trade) {
     std::string commod = trade->first.request->commodity();
     double req_qty = trade->first.request->target()->quantity();
     cyclus::Request<Material>* req = trade->first.request;
     Material::Ptr m = trade->second;
+    cyclus::toolkit::ResBuf<Material>* inv;
     if (req_inventories_[req] == "fill") {
-      fill.Push(m);
+      inv = &fill;
     } else if (req_inventories_[req] == "topup") {
-      topup.Push(m);
+      inv = &topup;
     } else if (req_inventories_[req] == "fiss") {
-      fiss.Push(m);
+      inv = &fiss;
     } else {
       throw cyclus::ValueError("cycamore::FuelFab was overmatched on requests");
     }
+    inv->Push(m);
+    if (track_lots) {
+      AddLot_(*inv, m);
+    }
   }
 
   req_inventories_.clear();
 
+  if (blend_lots || keep_lots) {
+    return;
+  }
+
   // IMPORTANT - each buffer needs to be a single homogenous composition or
   // the inventory mixing constraints for bids don't work
   if (fill.count() > 1) {
@@ -285,38 +333,40 @@ std::set<cyclus::BidPortfolio<Material>::Ptr> FuelFab::GetMatlBids(
     return ports;
   } else if (reqs.size() == 0) {
     return ports;
+  } else if (blend_lots) {
+    return BlendBids_(reqs);
   }
 
   double w_fill = 0;
   Composition::Ptr
       c_fill;  // no default needed - this is non-optional parameter
   if (fill.count() > 0) {
-    c_fill = fill.Peek()->comp();
-    w_fill = CosiWeight(c_fill, spectrum);
+    c_fill = InvComp_(fill);
+    w_fill = CosiWeight(c_fill, spec_);
   } else {
     c_fill = context()->GetRecipe(fill_recipe);
-    w_fill = CosiWeight(c_fill, spectrum);
+    w_fill = CosiWeight(c_fill, spec_);
   }
 
   double w_topup = 0;
   Composition::Ptr c_topup = c_fill;
   if (topup.count() > 0) {
-    c_topup = topup.Peek()->comp();
-    w_topup = CosiWeight(c_topup, spectrum);
+    c_topup = InvComp_(topup);
+    w_topup = CosiWeight(c_topup, spec_);
   } else if (!topup_recipe.empty()) {
     c_topup = context()->GetRecipe(topup_recipe);
-    w_topup = CosiWeight(c_topup, spectrum);
+    w_topup = CosiWeight(c_topup, spec_);
   }
 
   double w_fiss =
       w_fill;  // this allows trading just fill with no fiss inventory
   Composition::Ptr c_fiss = c_fill;
   if (fiss.count() > 0) {
-    c_fiss = fiss.Peek()->comp();
-    w_fiss = CosiWeight(c_fiss, spectrum);
+    c_fiss = InvComp_(fiss);
+    w_fiss = CosiWeight(c_fiss, spec_);
   } else if (!fiss_recipe.empty()) {
     c_fiss = context()->GetRecipe(fiss_recipe);
-    w_fiss = CosiWeight(c_fiss, spectrum);
+    w_fiss = CosiWeight(c_fiss, spec_);
   }
 
   BidPortfolio<Material>::Ptr port(new BidPortfolio<Material>());
@@ -324,7 +374,7 @@ std::set<cyclus::BidPortfolio<Material>::Ptr> FuelFab::GetMatlBids(
     cyclus::Request<Material>* req = reqs[j];
 
     Composition::Ptr tgt = req->target()->comp();
-    double w_tgt = CosiWeight(tgt, spectrum);
+    double w_tgt = CosiWeight(tgt, spec_);
     double tgt_qty = req->target()->quantity();
     if (ValidWeights(w_fill, w_tgt, w_fiss)) {
       double fiss_frac = HighFrac(w_fill, w_tgt, w_fiss);
@@ -366,11 +416,11 @@ std::set<cyclus::BidPortfolio<Material>::Ptr> FuelFab::GetMatlBids(
   }
 
   cyclus::Converter<Material>::Ptr fissconv(
-      new FissConverter(c_fill, c_fiss, c_topup, spectrum));
+      new FissConverter(c_fill, c_fiss, c_topup, spec_));
   cyclus::Converter<Material>::Ptr fillconv(
-      new FillConverter(c_fill, c_fiss, c_topup, spectrum));
+      new FillConverter(c_fill, c_fiss, c_topup, spec_));
   cyclus::Converter<Material>::Ptr topupconv(
-      new TopupConverter(c_fill, c_fiss, c_topup, spectrum));
+      new TopupConverter(c_fill, c_fiss, c_topup, spec_));
   // important! - the std::max calls prevent CapacityConstraint throwing a zero
   // cap exception
   cyclus::CapacityConstraint<Material> fissc(std::max(fiss.quantity(), cyclus::CY_NEAR_ZERO),
@@ -395,19 +445,24 @@ void FuelFab::GetMatlTrades(
         responses) {
   using cyclus::Trade;
 
+  if (blend_lots) {
+    BlendTrades_(trades, responses);
+    return;
+  }
+
   // guard against cases where a buffer is empty - this is okay because some
   // trades may not need that particular buffer.
   double w_fill = 0;
   if (fill.count() > 0) {
-    w_fill = CosiWeight(fill.Peek()->comp(), spectrum);
+    w_fill = CosiWeight(InvComp_(fill), spec_);
   }
   double w_topup = 0;
   if (topup.count() > 0) {
-    w_topup = CosiWeight(topup.Peek()->comp(), spectrum);
+    w_topup = CosiWeight(InvComp_(topup), spec_);
   }
   double w_fiss = 0;
   if (fiss.count() > 0) {
-    w_fiss = CosiWeight(fiss.Peek()->comp(), spectrum);
+    w_fiss = CosiWeight(InvComp_(fiss), spec_);
   }
 
   std::vector<cyclus::Trade<Material> >::const_iterator it;
@@ -415,7 +470,7 @@ void FuelFab::GetMatlTrades(
   for (int i = 0; i < trades.size(); i++) {
     Material::Ptr tgt = trades[i].request->target();
 
-    double w_tgt = CosiWeight(tgt->comp(), spectrum);
+    double w_tgt = CosiWeight(tgt->comp(), spec_);
     double qty = trades[i].amt;
     double wfiss = w_fiss;
 
@@ -434,7 +489,7 @@ void FuelFab::GetMatlTrades(
         fillqty = std::min(fill.quantity(), qty);
       }
       responses.push_back(
-          std::make_pair(trades[i], fill.Pop(fillqty, cyclus::eps_rsrc())));
+          std::make_pair(trades[i], InvPop_(fill, fillqty)));
     } else if (fill.count() == 0 && ValidWeights(w_fill, w_tgt, w_fiss)) {
       // use straight fissile to satisfy this request
       double fissqty = qty;
@@ -442,14 +497,14 @@ void FuelFab::GetMatlTrades(
         fissqty = std::min(fiss.quantity(), qty);
       }
       responses.push_back(
-          std::make_pair(trades[i], fiss.Pop(fissqty, cyclus::eps_rsrc())));
+          std::make_pair(trades[i], InvPop_(fiss, fissqty)));
     } else if (ValidWeights(w_fill, w_tgt, w_fiss)) {
       double fiss_frac = HighFrac(w_fill, w_tgt, w_fiss);
       double fill_frac = LowFrac(w_fill, w_tgt, w_fiss);
       fiss_frac =
-          AtomToMassFrac(fiss_frac, fiss.Peek()->comp(), fill.Peek()->comp());
+          AtomToMassFrac(fiss_frac, InvComp_(fiss), InvComp_(fill));
       fill_frac =
-          AtomToMassFrac(fill_frac, fill.Peek()->comp(), fiss.Peek()->comp());
+          AtomToMassFrac(fill_frac, InvComp_(fill), InvComp_(fiss));
 
       double fissqty = fiss_frac * qty;
       if (std::abs(fissqty - fiss.quantity()) < cyclus::eps_rsrc()) {
@@ -460,19 +515,19 @@ void FuelFab::GetMatlTrades(
         fillqty = std::min(fill.quantity(), fill_frac * qty);
       }
 
-      Material::Ptr m = fiss.Pop(fissqty, cyclus::eps_rsrc());
+      Material::Ptr m = InvPop_(fiss, fissqty);
       // this if block prevents zero qty ResBuf pop exceptions
       if (fill_frac > 0) {
-        m->Absorb(fill.Pop(fillqty, cyclus::eps_rsrc()));
+        m->Absorb(InvPop_(fill, fillqty));
       }
       responses.push_back(std::make_pair(trades[i], m));
     } else {
       double topup_frac = HighFrac(w_fiss, w_tgt, w_topup);
       double fiss_frac = 1 - topup_frac;
       topup_frac =
-          AtomToMassFrac(topup_frac, topup.Peek()->comp(), fiss.Peek()->comp());
+          AtomToMassFrac(topup_frac, InvComp_(topup), InvComp_(fiss));
       fiss_frac =
-          AtomToMassFrac(fiss_frac, fiss.Peek()->comp(), topup.Peek()->comp());
+          AtomToMassFrac(fiss_frac, InvComp_(fiss), InvComp_(topup));
 
       double fissqty = fiss_frac * qty;
       if (std::abs(fissqty - fiss.quantity()) < cyclus::eps_rsrc()) {
@@ -483,20 +538,448 @@ void FuelFab::GetMatlTrades(
         topupqty = std::min(topup.quantity(), topup_frac * qty);
       }
 
-      Material::Ptr m = fiss.Pop(fissqty, cyclus::eps_rsrc());
+      Material::Ptr m = InvPop_(fiss, fissqty);
       // this if block prevents zero qty ResBuf pop exceptions
       if (topup_frac > 0) {
-        m->Absorb(topup.Pop(topupqty, cyclus::eps_rsrc()));
+        m->Absorb(InvPop_(topup, topupqty));
       }
       responses.push_back(std::make_pair(trades[i], m));
     }
   }
 }
 
+int FuelFab::InvIndex_(cyclus::toolkit::ResBuf<Material>& inv) {
+  return &inv == &fill ? 0 : (&inv == &fiss ? 1 : 2);
+}
+
+// Adds qty of composition c to the nuclide masses in masses, or removes it
+// if qty is negative.
+static void AddMasses(Composition::Ptr c, double qty,
+                      cyclus::CompMap* masses) {
+  const cyclus::CompMap& cm = c->mass();
+  cyclus::CompMap::const_iterator it;
+  double tot = 0;
+  for (it = cm.begin(); it != cm.end(); ++it) {
+    tot += it->second;
+  }
+  if (tot <= 0) {
+    return;
+  }
+
+  for (it = cm.begin(); it != cm.end(); ++it) {
+    double& mass = (*masses)[it->first];
+    mass += qty * it->second / tot;
+    if (mass <= 0) {
+      masses->erase(it->first);
+    }
+  }
+}
+
+void FuelFab::IndexLots_() {
+  if (lots_indexed_) {
+    return;
+  }
+
+  lots_indexed_ = true;
+  lot_masses_.assign(3, cyclus::CompMap());
+  lot_comps_.assign(3, Composition::Ptr());
+  cyclus::toolkit::ResBuf<Material>* bufs[] = {&fill, &fiss, &topup};
+  for (int b = 0; b < 3; b++) {
+    cyclus::toolkit::MatVec mats = bufs[b]->PopN(bufs[b]->count());
+    bufs[b]->Push(mats);
+    for (int i = 0; i < mats.size(); i++) {
+      AddLot_(*bufs[b], mats[i]);
+    }
+  }
+}
+
+void FuelFab::AddLot_(cyclus::toolkit::ResBuf<Material>& inv,
+                      Material::Ptr m) {
+  int i = InvIndex_(inv);
+  AddMasses(m->comp(), m->quantity(), &lot_masses_[i]);
+  lot_comps_[i].reset();
+}
+
+Composition::Ptr FuelFab::InvComp_(cyclus::toolkit::ResBuf<Material>& inv) {
+  if (!keep_lots || inv.count() < 2) {
+    return inv.Peek()->comp();
+  }
+
+  IndexLots_();
+  int i = InvIndex_(inv);
+  if (!lot_comps_[i]) {
+    lot_comps_[i] = Composition::CreateFromMass(lot_masses_[i]);
+  }
+  return lot_comps_[i];
+}
+
+Material::Ptr FuelFab::InvPop_(cyclus::toolkit::ResBuf<Material>& inv,
+                               double qty) {
+  if (!keep_lots) {
+    return inv.Pop(qty, cyclus::eps_rsrc());
+  }
+
+  IndexLots_();
+  Material::Ptr m;
+  if (inv.count() < 2) {
+    m = inv.Pop(qty, cyclus::eps_rsrc());
+  } else {
+    // taking the same fraction of every lot leaves the combined composition
+    // used for bidding unchanged.  Lots that would be left with no more than
+    // rounding errors are withdrawn whole so drained lots are retired.
+    double frac = std::min(1.0, qty / inv.quantity());
+    cyclus::toolkit::MatVec lots = inv.PopN(inv.count());
+    for (int j = 0; j < lots.size(); j++) {
+      Material::Ptr part = lots[j];
+      double lotqty = frac * lots[j]->quantity();
+      if (lots[j]->quantity() - lotqty > cyclus::eps_rsrc()) {
+        part = lots[j]->ExtractQty(lotqty);
+        inv.Push(lots[j]);
+      }
+      if (!m) {
+        m = part;
+      } else {
+        m->Absorb(part);
+      }
+    }
+  }
+
+  int i = InvIndex_(inv);
+  if (inv.count() > 0) {
+    AddMasses(m->comp(), -m->quantity(), &lot_masses_[i]);
+  } else {
+    lot_masses_[i].clear();
+  }
+  lot_comps_[i].reset();
+  return m;
+}
+
+std::vector<Material::Ptr> FuelFab::Lots_() {
+  std::vector<Material::Ptr> lots;
+  cyclus::toolkit::ResBuf<Material>* bufs[] = {&fill, &fiss, &topup};
+  for (int b = 0; b < 3; b++) {
+    cyclus::toolkit::MatVec mats = bufs[b]->PopN(bufs[b]->count());
+    bufs[b]->Push(mats);
+    lots.insert(lots.end(), mats.begin(), mats.end());
+  }
+  return lots;
+}
+
+std::set<cyclus::BidPortfolio<Material>::Ptr> FuelFab::BlendBids_(
+    std::vector<cyclus::Request<Material>*>& reqs) {
+  using cyclus::BidPortfolio;
+
+  std::set<BidPortfolio<Material>::Ptr> ports;
+  blend_fracs_.reset(new BlendFracs());
+  std::vector<Material::Ptr> lots = Lots_();
+  int n = lots.size();
+  if (n == 0) {
+    return ports;
+  }
+
+  int n_fill = fill.count();
+  int n_fiss = fiss.count();
+  std::vector<double> w(n);
+  std::vector<double> mass(n);
+  std::vector<double> cost(n);
+  for (int i = 0; i < n; i++) {
+    w[i] = CosiWeight(lots[i]->comp(), spec_);
+    mass[i] = MeanAtomicMass(lots[i]->comp());
+    if (i < n_fill) {
+      cost[i] = fill_blend_cost;
+    } else if (i < n_fill + n_fiss) {
+      cost[i] = fiss_blend_cost;
+    } else {
+      cost[i] = topup_blend_cost;
+    }
+  }
+
+  // requests for the same composition and quantity share one solve
+  std::map<std::pair<int, double>, std::vector<double> > solved;
+  BidPortfolio<Material>::Ptr port(new BidPortfolio<Material>());
+  for (int j = 0; j < reqs.size(); j++) {
+    cyclus::Request<Material>* req = reqs[j];
+    Material::Ptr tgt = req->target();
+    double tgt_qty = tgt->quantity();
+    std::pair<int, double> key(tgt->comp()->id(), tgt_qty);
+    std::map<std::pair<int, double>, std::vector<double> >::iterator it =
+        solved.find(key);
+    if (it == solved.end()) {
+      double w_tgt = CosiWeight(tgt->comp(), spec_);
+      std::vector<double> max_frac(n);
+      for (int i = 0; i < n; i++) {
+        max_frac[i] = lots[i]->quantity() / tgt_qty;
+      }
+      std::vector<double> fracs;
+      if (!BlendLots(w_tgt, w, mass, cost, max_frac, &fracs)) {
+        // too little inventory for the whole request - bid the cheapest
+        // blend anyway and let the lot constraints cut the trade back
+        max_frac.assign(n, 1);
+        if (!BlendLots(w_tgt, w, mass, cost, max_frac, &fracs)) {
+          fracs.clear();
+        }
+      }
+      it = solved.insert(std::make_pair(key, fracs)).first;
+    }
+
+    const std::vector<double>& fracs = it->second;
+    if (fracs.empty()) {
+      if (n_fiss > 0 && n > n_fiss) {
+        std::stringstream ss;
+        ss << "prototype '" << prototype()
+           << "': Input stream weights/reactivity do not span "
+              "the requested material weight.";
+        cyclus::Warn<cyclus::VALUE_WARNING>(ss.str());
+      }
+      continue;
+    }
+
+    Material::Ptr m;
+    for (int i = 0; i < n; i++) {
+      if (fracs[i] <= 0) {
+        continue;
+      }
+      Material::Ptr part =
+          Material::CreateUntracked(fracs[i] * tgt_qty, lots[i]->comp());
+      if (!m) {
+        m = part;
+      } else {
+        m->Absorb(part);
+      }
+    }
+    (*blend_fracs_)[m.get()] = fracs;
+    bool exclusive = false;
+    port->AddBid(req, m, this, exclusive);
+  }
+
+  for (int i = 0; i < n; i++) {
+    cyclus::Converter<Material>::Ptr conv(new LotConverter(blend_fracs_, i));
+    cyclus::CapacityConstraint<Material> c(
+        std::max(lots[i]->quantity(), cyclus::CY_NEAR_ZERO), conv);
+    port->AddConstraint(c);
+  }
+  cyclus::CapacityConstraint<Material> cc(throughput);
+  port->AddConstraint(cc);
+  ports.insert(port);
+  return ports;
+}
+
+void FuelFab::BlendTrades_(
+    const std::vector<cyclus::Trade<Material> >& trades,
+    std::vector<std::pair<cyclus::Trade<Material>, Material::Ptr> >&
+        responses) {
+  // withdraw from the lots directly and put what is left back afterwards
+  cyclus::toolkit::ResBuf<Material>* bufs[] = {&fill, &fiss, &topup};
+  std::vector<Material::Ptr> lots;
+  std::vector<int> lot_bufs;
+  for (int b = 0; b < 3; b++) {
+    cyclus::toolkit::MatVec mats = bufs[b]->PopN(bufs[b]->count());
+    lots.insert(lots.end(), mats.begin(), mats.end());
+    lot_bufs.insert(lot_bufs.end(), mats.size(), b);
+  }
+
+  double tot = 0;
+  for (int i = 0; i < trades.size(); i++) {
+    double qty = trades[i].amt;
+    tot += qty;
+    if (tot > throughput + cyclus::eps_rsrc()) {
+      std::stringstream ss;
+      ss << "FuelFab was matched above throughput limit: " << tot << " > "
+         << throughput;
+      throw cyclus::ValueError(ss.str());
+    }
+
+    BlendFracs::iterator it = blend_fracs_->find(trades[i].bid->offer().get());
+    if (it == blend_fracs_->end() || it->second.size() != lots.size()) {
+      throw cyclus::ValueError("cycamore::FuelFab was matched on an unknown bid");
+    }
+
+    const std::vector<double>& fracs = it->second;
+    Material::Ptr m;
+    for (int j = 0; j < lots.size(); j++) {
+      double lotqty = fracs[j] * qty;
+      if (lotqty <= 0) {
+        continue;
+      } else if (lotqty > lots[j]->quantity() + cyclus::eps_rsrc()) {
+        std::stringstream ss;
+        ss << "cycamore::FuelFab lot " << j << " has " << lots[j]->quantity()
+           << " kg left, short of the " << lotqty << " kg its blend needs";
+        throw cyclus::ValueError(ss.str());
+      }
+      lotqty = std::min(lotqty, lots[j]->quantity());
+      if (lots[j]->quantity() - lotqty <= cyclus::eps_rsrc()) {
+        // a lot drained down to rounding errors goes out whole
+        lotqty = lots[j]->quantity();
+      }
+      Material::Ptr part = lots[j]->ExtractQty(lotqty);
+      if (!m) {
+        m = part;
+      } else {
+        m->Absorb(part);
+      }
+    }
+    responses.push_back(std::make_pair(trades[i], m));
+  }
+
+  // emptied lots are retired
+  for (int j = 0; j < lots.size(); j++) {
+    if (lots[j]->quantity() > 0) {
+      bufs[lot_bufs[j]]->Push(lots[j]);
+    }
+  }
+}
+
 extern "C" cyclus::Agent* ConstructFuelFab(cyclus::Context* ctx) {
   return new FuelFab(ctx);
 }
 
+// Compact nuclide index used by CosiTable: ground and first metastable
+// states of elements 1 through kMaxZ with Z <= A < 3*Z + 11, laid out element
+// by element.  That covers every nuclide pyne has 1 group cross sections for
+// in a table of a few tens of thousands of entries.
+static const int kMaxZ = 118;
+
+static int NucSpan(int z) {
+  return 2 * z + 11;
+}
+
+// Returns the index of nuc in a CosiTable or -1 if it is outside the table.
+static int NucIndex(cyclus::Nuc nuc) {
+  int z = nuc / 10000000;
+  int a = (nuc / 10000) % 1000;
+  int s = nuc % 10000;
+  if (z < 1 || z > kMaxZ || s > 1 || a < z || a - z >= NucSpan(z)) {
+    return -1;
+  }
+  // 2 * (NucSpan(1) + ... + NucSpan(z - 1)) entries precede element z
+  return 2 * (z - 1) * (z + 11) + 2 * (a - z) + s;
+}
+
+// Reactivity data for one spectrum: the weight
+//
+//     (p - p_U238) / (p_Pu239 - p_U238)
+//
+// of every nuclide, with p = nu*sigma_f - sigma_a, in a dense array indexed
+// by NucIndex.  All pyne lookups happen on construction and a table is never
+// modified afterwards, so a weight lookup is a plain array read.
+class CosiTable {
+ public:
+  explicit CosiTable(Spectrum spectrum) : energy_(kSpectrumNames[spectrum]) {
+    if (spectrum == THERMAL) {
+      nu_pu239_ = 2.85;
+      nu_u233_ = 2.5;
+      nu_u235_ = 2.43;
+    } else {
+      nu_pu239_ = 3.1;
+      nu_u233_ = 2.63;
+      nu_u235_ = 2.58;
+    }
+    // nu_u238 is zero
+    p_u238_ = -simple_xs(922380000, "absorption", energy_);
+    p_pu239_ = nu_pu239_ * simple_xs(942390000, "fission", energy_) -
+               simple_xs(942390000, "absorption", energy_);
+    default_weight_ = Normalize(0);
+
+    weights_.resize(2 * kMaxZ * (kMaxZ + 12), default_weight_);
+    for (int z = 1; z <= kMaxZ; z++) {
+      for (int a = z; a - z < NucSpan(z); a++) {
+        for (int s = 0; s < 2; s++) {
+          cyclus::Nuc nuc = z * 10000000 + a * 10000 + s;
+          weights_[NucIndex(nuc)] = Normalize(P(nuc));
+        }
+      }
+    }
+  }
+
+  // Nuclides outside the table (higher metastable states) are treated as
+  // having no cross sections.
+  double Weight(cyclus::Nuc nuc) const {
+    int i = NucIndex(nuc);
+    return i < 0 ? default_weight_ : weights_[i];
+  }
+
+  static const char* kSpectrumNames[];
+
+ private:
+  double Normalize(double p) const {
+    return (p - p_u238_) / (p_pu239_ - p_u238_);
+  }
+
+  // Returns nu*sigma_f - sigma_a for nuc, or zero if pyne has no cross
+  // sections for it.
+  double P(cyclus::Nuc nuc) const {
+    double nu = 0;
+    if (nuc == 922350000) {
+      nu = nu_u235_;
+    } else if (nuc == 922330000) {
+      nu = nu_u233_;
+    } else if (nuc == 942390000 || nuc == 942410000) {
+      nu = nu_pu239_;
+    }
+    try {
+      // most candidate nuclides have no data; look absorption up first so
+      // they cost a single failed lookup
+      double absorb = simple_xs(nuc, "absorption", energy_);
+      return nu * simple_xs(nuc, "fission", energy_) - absorb;
+    } catch (const std::exception& err) {
+      // pyne::InvalidSimpleXS or an id pyne does not accept as a nuclide
+      return 0;
+    }
+  }
+
+  std::string energy_;
+  double nu_pu239_;
+  double nu_u233_;
+  double nu_u235_;
+  double p_u238_;
+  double p_pu239_;
+  double default_weight_;
+  std::vector<double> weights_;
+};
+
+// indexed by Spectrum
+const char* CosiTable::kSpectrumNames[] = {
+    "thermal", "thermal_maxwell_ave", "fission_spectrum_ave",
+    "resonance_integral", "fourteen_MeV"};
+
+Spectrum SpectrumFromName(const std::string& spectrum) {
+  for (int i = 0; i <= FOURTEEN_MEV; i++) {
+    if (spectrum == CosiTable::kSpectrumNames[i]) {
+      return static_cast<Spectrum>(i);
+    }
+  }
+  throw cyclus::ValueError("unknown cross section spectrum '" + spectrum + "'");
+}
+
+// Guards pyne nuclear data lookups and Composition::atom (which converts
+// lazily); neither is safe to run concurrently.  It is only taken while
+// building a CosiTable and on memo misses, never for a memoized lookup.
+static std::mutex nuc_data_mutex;
+
+// Memoized composition weights per spectrum and mean atomic masses, keyed by
+// composition id.  Compositions are immutable so an entry never goes stale.
+// The memos are per thread, so lookups need no locking, and are cleared when
+// they grow past kMaxCosiWeights to bound memory in long simulations with
+// many decayed compositions.
+static const int kMaxCosiWeights = 4096;
+static thread_local std::unordered_map<int, double>
+    cosi_weights[FOURTEEN_MEV + 1];
+static thread_local std::unordered_map<int, double> mean_masses;
+
+// One table per spectrum, each built exactly once on first use of its
+// spectrum (pyne's cross section data is not available before the nuclear
+// data path is set) and shared read-only by all FuelFab agents.
+static std::once_flag cosi_table_flags[FOURTEEN_MEV + 1];
+static std::unique_ptr<const CosiTable> cosi_tables[FOURTEEN_MEV + 1];
+
+static const CosiTable& GetCosiTable(Spectrum spectrum) {
+  std::call_once(cosi_table_flags[spectrum], [spectrum]() {
+    std::lock_guard<std::mutex> lock(nuc_data_mutex);
+    cosi_tables[spectrum].reset(new CosiTable(spectrum));
+  });
+  return *cosi_tables[spectrum];
+}
+
 // Returns the weight of c using 1 group cross sections of type spectrum
 // which must be one of:
 //
@@ -510,196 +993,73 @@ extern "C" cyclus::Agent* ConstructFuelFab(cyclus::Context* ctx) {
 // are computed based on nuclide atom fractions, corresponding computed
 // material/mixing fractions will also be atom-based naturally and will need
 // to be converted to mass-based for actual material object mixing.
-double CosiWeight(Composition::Ptr c, const std::string& spectrum) {
-  cyclus::CompMap cm = c->atom();
-  cyclus::compmath::Normalize(&cm);
-
-  if (spectrum == "thermal") {
-    double nu_pu239 = 2.85;
-    double nu_u233 = 2.5;
-    double nu_u235 = 2.43;
-    double nu_u238 = 0;
-    double nu_pu241 = nu_pu239;
-
-    static std::map<int, double> absorb_xs;
-    static std::map<int, double> fiss_xs;
-    static double p_u238 = 0;
-    static double p_pu239 = 0;
-    if (p_u238 == 0) {
-      double fiss_u238 = simple_xs(922380000, "fission", "thermal");
-      double absorb_u238 = simple_xs(922380000, "absorption", "thermal");
-      p_u238 = nu_u238 * fiss_u238 - absorb_u238;
-
-      double fiss_pu239 = simple_xs(942390000, "fission", "thermal");
-      double absorb_pu239 = simple_xs(942390000, "absorption", "thermal");
-      p_pu239 = nu_pu239 * fiss_pu239 - absorb_pu239;
-    }
-
-    cyclus::CompMap::iterator it;
-    double w = 0;
-    for (it = cm.begin(); it != cm.end(); ++it) {
-      cyclus::Nuc nuc = it->first;
-      double nu = 0;
-      if (nuc == 922350000) {
-        nu = nu_u235;
-      } else if (nuc == 922330000) {
-        nu = nu_u233;
-      } else if (nuc == 942390000) {
-        nu = nu_pu239;
-      } else if (nuc == 942410000) {
-        nu = nu_pu241;
-      }
+//
+// The weight depends only on c and spectrum and CosiWeight is safe to call
+// concurrently, e.g. for several FuelFab agents at once.
+double CosiWeight(Composition::Ptr c, Spectrum spectrum) {
+  std::unordered_map<int, double>& weights = cosi_weights[spectrum];
+  std::unordered_map<int, double>::iterator found = weights.find(c->id());
+  if (found != weights.end()) {
+    return found->second;
+  }
 
-      double fiss = 0;
-      double absorb = 0;
-      if (absorb_xs.count(nuc) == 0) {
-        try {
-          fiss = simple_xs(nuc, "fission", "thermal");
-          absorb = simple_xs(nuc, "absorption", "thermal");
-          absorb_xs[nuc] = absorb;
-          fiss_xs[nuc] = fiss;
-        } catch (pyne::InvalidSimpleXS err) {
-          fiss = 0;
-          absorb = 0;
-        }
-      } else {
-        fiss = fiss_xs[nuc];
-        absorb = absorb_xs[nuc];
-      }
+  const CosiTable& table = GetCosiTable(spectrum);
+  std::unique_lock<std::mutex> lock(nuc_data_mutex);
+  const cyclus::CompMap& cm = c->atom();
+  cyclus::CompMap::const_iterator it;
+  double w = 0;
+  double tot = 0;
+  for (it = cm.begin(); it != cm.end(); ++it) {
+    w += it->second * table.Weight(it->first);
+    tot += it->second;
+  }
+  lock.unlock();
+  // normalizing once at the end is the same as weighting atom fractions
+  w = tot > 0 ? w / tot : 0;
 
-      double p = nu * fiss - absorb;
-      w += it->second * (p - p_u238) / (p_pu239 - p_u238);
-    }
-    return w;
-  } else if (spectrum == "fission_spectrum_ave") {
-    double nu_pu239 = 3.1;
-    double nu_u233 = 2.63;
-    double nu_u235 = 2.58;
-    double nu_u238 = 0;
-    double nu_pu241 = nu_pu239;
-
-    static std::map<int, double> absorb_xs;
-    static std::map<int, double> fiss_xs;
-    static double p_u238 = 0;
-    static double p_pu239 = 0;
-    if (p_u238 == 0) {
-      double fiss_u238 =
-          simple_xs(922380000, "fission", "fission_spectrum_ave");
-      double absorb_u238 =
-          simple_xs(922380000, "absorption", "fission_spectrum_ave");
-      p_u238 = nu_u238 * fiss_u238 - absorb_u238;
-
-      double fiss_pu239 =
-          simple_xs(942390000, "fission", "fission_spectrum_ave");
-      double absorb_pu239 =
-          simple_xs(942390000, "absorption", "fission_spectrum_ave");
-      p_pu239 = nu_pu239 * fiss_pu239 - absorb_pu239;
-    }
-
-    cyclus::CompMap::iterator it;
-    double w = 0;
-    for (it = cm.begin(); it != cm.end(); ++it) {
-      cyclus::Nuc nuc = it->first;
-      double nu = 0;
-      if (nuc == 922350000) {
-        nu = nu_u235;
-      } else if (nuc == 922330000) {
-        nu = nu_u233;
-      } else if (nuc == 942390000) {
-        nu = nu_pu239;
-      } else if (nuc == 942410000) {
-        nu = nu_pu241;
-      }
+  if (weights.size() >= kMaxCosiWeights) {
+    weights.clear();
+  }
+  weights[c->id()] = w;
+  return w;
+}
 
-      double fiss = 0;
-      double absorb = 0;
-      if (absorb_xs.count(nuc) == 0) {
-        try {
-          fiss = simple_xs(nuc, "fission", "fission_spectrum_ave");
-          absorb = simple_xs(nuc, "absorption", "fission_spectrum_ave");
-          absorb_xs[nuc] = absorb;
-          fiss_xs[nuc] = fiss;
-        } catch (pyne::InvalidSimpleXS err) {
-          fiss = 0;
-          absorb = 0;
-        }
-      } else {
-        fiss = fiss_xs[nuc];
-        absorb = absorb_xs[nuc];
-      }
+double CosiWeight(Composition::Ptr c, const std::string& spectrum) {
+  return CosiWeight(c, SpectrumFromName(spectrum));
+}
 
-      double p = nu * fiss - absorb;
-      w += it->second * (p - p_u238) / (p_pu239 - p_u238);
-    }
-    return w;
-  } else {
-    double nu_pu239 = 3.1;
-    double nu_u233 = 2.63;
-    double nu_u235 = 2.58;
-    double nu_u238 = 0;
-    double nu_pu241 = nu_pu239;
-
-    double fiss_u238 = simple_xs(922380000, "fission", spectrum);
-    double absorb_u238 = simple_xs(922380000, "absorption", spectrum);
-    double p_u238 = nu_u238 * fiss_u238 - absorb_u238;
-
-    double fiss_pu239 = simple_xs(942390000, "fission", spectrum);
-    double absorb_pu239 = simple_xs(942390000, "absorption", spectrum);
-    double p_pu239 = nu_pu239 * fiss_pu239 - absorb_pu239;
-
-    cyclus::CompMap::iterator it;
-    double w = 0;
-    for (it = cm.begin(); it != cm.end(); ++it) {
-      cyclus::Nuc nuc = it->first;
-      double nu = 0;
-      if (nuc == 922350000) {
-        nu = nu_u235;
-      } else if (nuc == 922330000) {
-        nu = nu_u233;
-      } else if (nuc == 942390000) {
-        nu = nu_pu239;
-      } else if (nuc == 942410000) {
-        nu = nu_pu241;
-      }
+// Returns the mean atomic mass of the atoms in c.
+static double MeanAtomicMass(Composition::Ptr c) {
+  std::unordered_map<int, double>::iterator found = mean_masses.find(c->id());
+  if (found != mean_masses.end()) {
+    return found->second;
+  }
 
-      double fiss = 0;
-      double absorb = 0;
-      try {
-        fiss = simple_xs(nuc, "fission", spectrum);
-        absorb = simple_xs(nuc, "absorption", spectrum);
-      } catch (pyne::InvalidSimpleXS err) {
-        fiss = 0;
-        absorb = 0;
-      }
+  std::unique_lock<std::mutex> lock(nuc_data_mutex);
+  const cyclus::CompMap& cm = c->atom();
+  cyclus::CompMap::const_iterator it;
+  double mass = 0;
+  double tot = 0;
+  for (it = cm.begin(); it != cm.end(); ++it) {
+    mass += it->second * pyne::atomic_mass(it->first);
+    tot += it->second;
+  }
+  lock.unlock();
+  mass /= tot;
 
-      double p = nu * fiss - absorb;
-      w += it->second * (p - p_u238) / (p_pu239 - p_u238);
-    }
-    return w;
+  if (mean_masses.size() >= kMaxCosiWeights) {
+    mean_masses.clear();
   }
+  mean_masses[c->id()] = mass;
+  return mass;
 }
 
 // Convert an atom frac (n1/(n1+n2) to a mass frac (m1/(m1+m2) given
 // corresponding compositions c1 and c2.
 double AtomToMassFrac(double atomfrac, Composition::Ptr c1,
                       Composition::Ptr c2) {
-  cyclus::CompMap n1 = c1->atom();
-  cyclus::CompMap n2 = c2->atom();
-  cyclus::compmath::Normalize(&n1, atomfrac);
-  cyclus::compmath::Normalize(&n2, 1 - atomfrac);
-
-  cyclus::CompMap::iterator it;
-
-  double mass1 = 0;
-  for (it = n1.begin(); it != n1.end(); ++it) {
-    mass1 += it->second * pyne::atomic_mass(it->first);
-  }
-
-  double mass2 = 0;
-  for (it = n2.begin(); it != n2.end(); ++it) {
-    mass2 += it->second * pyne::atomic_mass(it->first);
-  }
-
+  double mass1 = atomfrac * MeanAtomicMass(c1);
+  double mass2 = (1 - atomfrac) * MeanAtomicMass(c2);
   return mass1 / (mass1 + mass2);
 }
 
@@ -730,4 +1090,161 @@ bool ValidWeights(double w_low, double w_target, double w_high) {
   return w_low <= w_target && w_target <= w_high;
 }
 
+// Pivots the dense simplex tableau t (rows x cols, row-major) on (r, c).
+static void Pivot(std::vector<double>& t, int rows, int cols, int r, int c) {
+  double* pr = &t[r * cols];
+  double p = pr[c];
+  for (int j = 0; j < cols; j++) {
+    pr[j] /= p;
+  }
+  for (int i = 0; i < rows; i++) {
+    double f = t[i * cols + c];
+    if (i == r || f == 0) {
+      continue;
+    }
+    double* pi = &t[i * cols];
+    for (int j = 0; j < cols; j++) {
+      pi[j] -= f * pr[j];
+    }
+  }
+}
+
+// Runs simplex iterations on tableau t, whose last row holds the reduced
+// costs of a minimization and last column the values of the basic variables,
+// using Bland's rule to avoid cycling.  Only the first n_enter columns may
+// enter the basis.
+static void Simplex(std::vector<double>& t, int rows, int cols, int n_enter,
+                    std::vector<int>& basis, double eps) {
+  int m = rows - 1;
+  double* obj = &t[m * cols];
+  while (true) {
+    int c = -1;
+    for (int j = 0; j < n_enter; j++) {
+      if (obj[j] < -eps) {
+        c = j;
+        break;
+      }
+    }
+    if (c < 0) {
+      return;
+    }
+
+    int r = -1;
+    double best = 0;
+    for (int i = 0; i < m; i++) {
+      double a = t[i * cols + c];
+      if (a <= eps) {
+        continue;
+      }
+      double ratio = t[i * cols + cols - 1] / a;
+      if (r < 0 || ratio < best - eps ||
+          (ratio < best + eps && basis[i] < basis[r])) {
+        r = i;
+        best = ratio;
+      }
+    }
+    if (r < 0) {
+      return;  // unbounded - can't happen since all fractions are <= 1
+    }
+    Pivot(t, rows, cols, r, c);
+    basis[r] = c;
+  }
+}
+
+// Solved with a dense two phase simplex.  The mass and weight balances get
+// artificial variables and each bounded lot a bound row with a slack
+// variable, so the tableau stays small for the handful of lots a FuelFab
+// typically holds.
+bool BlendLots(double w_tgt, const std::vector<double>& w,
+               const std::vector<double>& mass,
+               const std::vector<double>& cost,
+               const std::vector<double>& max_frac, std::vector<double>* fracs,
+               double eps) {
+  int n = w.size();
+  fracs->assign(n, 0);
+  if (n == 0) {
+    return false;
+  }
+
+  std::vector<int> bounded;
+  double mean_mass = 0;
+  for (int i = 0; i < n; i++) {
+    if (max_frac[i] < 1) {
+      bounded.push_back(i);
+    }
+    mean_mass += mass[i] / n;
+  }
+
+  // columns: lot fractions, bound slacks, 2 artificials and the rhs
+  int m = 2 + bounded.size();
+  int n_vars = n + bounded.size();
+  int rows = m + 1;
+  int cols = n_vars + 3;
+  std::vector<double> t(rows * cols, 0);
+  std::vector<int> basis(m);
+  for (int i = 0; i < n; i++) {
+    t[i] = 1;
+    // scaled by the mean atomic mass to keep coefficients near one
+    t[cols + i] = (w[i] - w_tgt) * mean_mass / mass[i];
+  }
+  t[cols - 1] = 1;
+  t[n_vars] = 1;
+  t[cols + n_vars + 1] = 1;
+  basis[0] = n_vars;
+  basis[1] = n_vars + 1;
+  for (int k = 0; k < bounded.size(); k++) {
+    double* row = &t[(2 + k) * cols];
+    row[bounded[k]] = 1;
+    row[n + k] = 1;
+    row[cols - 1] = std::max(0.0, max_frac[bounded[k]]);
+    basis[2 + k] = n + k;
+  }
+
+  // phase 1 - drive the artificials to zero
+  double* obj = &t[m * cols];
+  for (int j = 0; j < cols; j++) {
+    obj[j] = -(t[j] + t[cols + j]);
+  }
+  obj[n_vars] = 0;
+  obj[n_vars + 1] = 0;
+  Simplex(t, rows, cols, n_vars, basis, eps);
+  if (-obj[cols - 1] > eps) {
+    return false;
+  }
+  for (int i = 0; i < m; i++) {
+    if (basis[i] < n_vars) {
+      continue;
+    }
+    for (int j = 0; j < n_vars; j++) {
+      if (std::abs(t[i * cols + j]) > eps) {
+        Pivot(t, rows, cols, i, j);
+        basis[i] = j;
+        break;
+      }
+    }
+  }
+
+  // phase 2 - minimize cost
+  for (int j = 0; j < cols; j++) {
+    obj[j] = j < n ? cost[j] : 0;
+  }
+  for (int i = 0; i < m; i++) {
+    double f = obj[basis[i]];
+    if (f == 0) {
+      continue;
+    }
+    for (int j = 0; j < cols; j++) {
+      obj[j] -= f * t[i * cols + j];
+    }
+  }
+  Simplex(t, rows, cols, n_vars, basis, eps);
+
+  for (int i = 0; i < m; i++) {
+    if (basis[i] < n) {
+      (*fracs)[basis[i]] = std::max(0.0, t[i * cols + cols - 1]);
+    }
+  }
+  return true;
+}
+
 }  // namespace cycamore
@@ -1,7 +1,9 @@
 #ifndef CYCAMORE_SRC_FUEL_FAB_H_
 #define CYCAMORE_SRC_FUEL_FAB_H_
 
+#include <map>
 #include <string>
+#include <vector>
 #include "cyclus.h"
 #include "cycamore_version.h"
 
@@ -9,6 +11,21 @@
 
 namespace cycamore {
 
+/// One group cross section spectra that CosiWeight can use, named as in
+/// pyne::simple_xs.
+enum Spectrum {
+  THERMAL,
+  THERMAL_MAXWELL_AVE,
+  FISSION_SPECTRUM_AVE,
+  RESONANCE_INTEGRAL,
+  FOURTEEN_MEV
+};
+
+/// Mass fraction of each input lot in the blend offered in each of a
+/// FuelFab's bids, keyed by the bid's offer.  Only used when lots are blended
+/// separately.
+typedef std::map<cyclus::Material*, std::vector<double> > BlendFracs;
+
 /// FuelFab takes in 2 streams of material and mixes them in ratios in order to
 /// supply material that matches some neutronics properties of reqeusted
 /// material.  It uses an equivalence type method [1]
@@ -50,6 +67,12 @@ namespace cycamore {
 /// By default, the top-up inventory size is zero, and it is not used for
 /// mixing.
 ///
+/// If keep_lots is enabled, received materials are kept as separate lots
+/// whose combined composition is used for mixing, and material is withdrawn
+/// from every lot in proportion to its quantity.  If blend_lots is enabled,
+/// received materials are also kept as separate lots, but each request is met
+/// with the blend of any of the lots that hits its weight at the least cost.
+///
 /// @code
 /// [1] Baker, A. R., and R. W. Ross. "Comparison of the value of plutonium and
 ///     uranium isotopes in fast reactors." Proceedings of the Conference on
@@ -102,6 +125,12 @@ class FuelFab
   " By default, the top-up inventory size is zero, and it is not used for" \
   " mixing. " \
   "\n\n" \
+  "If keep_lots is enabled, received materials are kept as separate lots" \
+  " whose combined composition is used for mixing, and material is withdrawn" \
+  " from every lot in proportion to its quantity.  If blend_lots is enabled," \
+  " received materials are also kept as separate lots, but each request is met" \
+  " with the blend of any of the lots that hits its weight at the least cost." \
+  "\n\n" \
   "[1] Baker, A. R., and R. W. Ross. \"Comparison of the value of plutonium and" \
   "    uranium isotopes in fast reactors.\" Proceedings of the Conference on" \
   "    Breeding. Economics, and Safety in Large Fast Power Reactors. 1963." \
@@ -134,6 +163,45 @@ class FuelFab
   GetMatlRequests();
 
  private:
+  /// Returns all lots of the fill, fiss and topup inventories in that order,
+  /// leaving the inventories unchanged.
+  std::vector<cyclus::Material::Ptr> Lots_();
+
+  /// Bids on each request with the cheapest blend of the separate inventory
+  /// lots that meets its weight.  Used instead of the default bids when
+  /// blend_lots is true.
+  std::set<cyclus::BidPortfolio<cyclus::Material>::Ptr> BlendBids_(
+      std::vector<cyclus::Request<cyclus::Material>*>& reqs);
+
+  /// Supplies trades by withdrawing from each lot the amounts determined
+  /// when bidding.  Used instead of the default trades when blend_lots is
+  /// true.
+  void BlendTrades_(
+      const std::vector<cyclus::Trade<cyclus::Material> >& trades,
+      std::vector<std::pair<cyclus::Trade<cyclus::Material>,
+                            cyclus::Material::Ptr> >& responses);
+
+  /// Returns the composition of all material in inv (fill, fiss or topup).
+  /// This is the single material's composition unless keep_lots is true.
+  cyclus::Composition::Ptr InvComp_(
+      cyclus::toolkit::ResBuf<cyclus::Material>& inv);
+
+  /// Withdraws qty from inv (fill, fiss or topup), from every lot in
+  /// proportion to its quantity if keep_lots is true.
+  cyclus::Material::Ptr InvPop_(
+      cyclus::toolkit::ResBuf<cyclus::Material>& inv, double qty);
+
+  /// Adds m, just pushed into inv, to the running nuclide masses of inv.
+  void AddLot_(cyclus::toolkit::ResBuf<cyclus::Material>& inv,
+               cyclus::Material::Ptr m);
+
+  /// Builds the running nuclide masses of each inventory from its lots if
+  /// they have not been built yet (e.g. after a restart).
+  void IndexLots_();
+
+  /// Returns the index of inv in lot_masses_ and lot_comps_.
+  int InvIndex_(cyclus::toolkit::ResBuf<cyclus::Material>& inv);
+
   // Code Injection:
   #include "toolkit/position.cycpp.h"
 
@@ -265,13 +333,105 @@ class FuelFab
   }
   std::string spectrum;
 
+  #pragma cyclus var { \
+    "default": False, \
+    "uilabel": "Blend Separate Lots", \
+    "doc": "If true, materials received into the filler, fissile and top-up" \
+           " inventories are kept as separate lots instead of being combined" \
+           " into one material per inventory.  Each request is then met with" \
+           " the cheapest blend of these lots that matches the requested" \
+           " weight, priced with fill_blend_cost, fiss_blend_cost and" \
+           " topup_blend_cost, found by solving a small linear program that" \
+           " also respects the quantity of each lot.  Each request is" \
+           " blended on its own, so lots offered to several requests in a" \
+           " time step are only limited by the exchange's capacity" \
+           " constraints.", \
+    "uitype": "bool", \
+  }
+  bool blend_lots;
+
+  #pragma cyclus var { \
+    "default": 0, \
+    "uilabel": "Filler Blend Cost", \
+    "doc": "Cost per kg of filler material in a blend of lots (see" \
+           " blend_lots).", \
+  }
+  double fill_blend_cost;
+
+  #pragma cyclus var { \
+    "default": 1, \
+    "uilabel": "Fissile Blend Cost", \
+    "doc": "Cost per kg of fissile material in a blend of lots (see" \
+           " blend_lots).", \
+  }
+  double fiss_blend_cost;
+
+  #pragma cyclus var { \
+    "default": 2, \
+    "uilabel": "Top-up Blend Cost", \
+    "doc": "Cost per kg of top-up material in a blend of lots (see" \
+           " blend_lots).  The default makes top-up worth using only when it" \
+           " saves more than twice its mass in fissile material.", \
+  }
+  double topup_blend_cost;
+
+  #pragma cyclus var { \
+    "default": False, \
+    "uilabel": "Keep Separate Lots", \
+    "doc": "If true, materials received into the filler, fissile and top-up" \
+           " inventories are kept as separate lots instead of being combined" \
+           " into one material per inventory.  Bids use the combined" \
+           " composition of all lots in an inventory, and material is" \
+           " withdrawn from every lot in proportion to its quantity so every" \
+           " withdrawal has that composition.  Lots drained down to rounding" \
+           " errors are retired.  Has no effect if blend_lots is true.", \
+    "uitype": "bool", \
+  }
+  bool keep_lots;
+
   // intra-time-step state - no need to be a state var
   // map<request, inventory name>
   std::map<cyclus::Request<cyclus::Material>*, std::string> req_inventories_;
 
+  // resolved from spectrum in EnterNotify - no need to persist
+  Spectrum spec_;
+
+  // intra-time-step state - no need to be a state var
+  // lot blends offered in the current exchange when blending lots
+  boost::shared_ptr<BlendFracs> blend_fracs_;
+
+  // nuclide masses and combined composition of the fill, fiss and topup
+  // inventories when keeping lots - rebuilt from the lots after a restart so
+  // no need to persist.  Compositions are created lazily.
+  std::vector<cyclus::CompMap> lot_masses_;
+  std::vector<cyclus::Composition::Ptr> lot_comps_;
+  bool lots_indexed_;
 };
 
+/// Returns the Spectrum named spectrum, throwing a ValueError for unknown
+/// names.
+Spectrum SpectrumFromName(const std::string& spectrum);
+/// Returns the reactivity weight of c for spectrum.  Depends only on its
+/// arguments and is safe to call from several threads at once.
+double CosiWeight(cyclus::Composition::Ptr c, Spectrum spectrum);
 double CosiWeight(cyclus::Composition::Ptr c, const std::string& spectrum);
+
+/// Finds the cheapest blend of input lots with weights w, mean atomic masses
+/// mass and costs per kg cost whose atom-weighted weight is w_tgt, i.e.
+/// solves the linear program
+///
+///     minimize    sum_i cost_i * x_i
+///     subject to  sum_i x_i = 1
+///                 sum_i x_i * (w_i - w_tgt) / mass_i = 0
+///                 0 <= x_i <= max_frac_i
+///
+/// for the mass fraction x_i of each lot in the blend.  Lots with max_frac
+/// of 1 or more are unbounded.  Returns false if no such blend exists.
+bool BlendLots(double w_tgt, const std::vector<double>& w,
+               const std::vector<double>& mass,
+               const std::vector<double>& cost,
+               const std::vector<double>& max_frac, std::vector<double>* fracs,
+               double eps = cyclus::CY_NEAR_ZERO);
 bool ValidWeights(double w_low, double w_tgt, double w_high);
 double LowFrac(double w_low, double w_tgt, double w_high, double eps = cyclus::CY_NEAR_ZERO);
 double HighFrac(double w_low, double w_tgt, double w_high, double eps = cyclus::CY_NEAR_ZERO);
@@ -2,6 +2,7 @@
 
 #include <gtest/gtest.h>
 #include <sstream>
+#include <thread>
 #include "cyclus.h"
 
 using pyne::nucname::id;
@@ -120,6 +121,70 @@ TEST(FuelFabTests, CosiWeight) {
   EXPECT_GT(w_therm, w_fast);
 }
 
+TEST(FuelFabTests, CosiWeight_Spectrum) {
+  cyclus::Env::SetNucDataPath();
+  EXPECT_EQ(THERMAL, SpectrumFromName("thermal"));
+  EXPECT_EQ(FISSION_SPECTRUM_AVE, SpectrumFromName("fission_spectrum_ave"));
+  EXPECT_EQ(FOURTEEN_MEV, SpectrumFromName("fourteen_MeV"));
+  EXPECT_THROW(SpectrumFromName("epithermal"), cyclus::ValueError);
+
+  // unnormalized atom fractions and repeated lookups give the same weight
+  CompMap m;
+  m[922380000] = 3;
+  m[942390000] = 1;
+  Composition::Ptr c = Composition::CreateFromAtom(m);
+  EXPECT_DOUBLE_EQ(0.25, CosiWeight(c, THERMAL));
+  EXPECT_DOUBLE_EQ(0.25, CosiWeight(c, "thermal"));
+  EXPECT_DOUBLE_EQ(0.25, CosiWeight(c, RESONANCE_INTEGRAL));
+  EXPECT_DOUBLE_EQ(CosiWeight(c_pustream(), "fission_spectrum_ave"),
+                   CosiWeight(c_pustream(), FISSION_SPECTRUM_AVE));
+}
+
+TEST(FuelFabTests, CosiWeight_Cached) {
+  cyclus::Env::SetNucDataPath();
+  CompMap m;
+  m[922380000] = 1;
+  m[942390000] = 1;
+  m[922350000] = 1;
+  Composition::Ptr c = Composition::CreateFromAtom(m);
+  double w_therm = CosiWeight(c, THERMAL);
+  double w_fast = CosiWeight(c, FISSION_SPECTRUM_AVE);
+  // cached weights are kept per spectrum
+  EXPECT_GT(w_therm, w_fast);
+  EXPECT_DOUBLE_EQ(w_therm, CosiWeight(c, THERMAL));
+  EXPECT_DOUBLE_EQ(w_fast, CosiWeight(c, FISSION_SPECTRUM_AVE));
+
+  // an equal composition with a different id gets the same weight
+  Composition::Ptr c2 = Composition::CreateFromAtom(m);
+  EXPECT_DOUBLE_EQ(w_therm, CosiWeight(c2, THERMAL));
+}
+
+TEST(FuelFabTests, CosiWeight_Threads) {
+  cyclus::Env::SetNucDataPath();
+  Composition::Ptr c = c_pustream();
+  Composition::Ptr fill = c_natu();
+  double w = CosiWeight(c, THERMAL);
+  double frac = AtomToMassFrac(0.5, c, fill);
+
+  // memos are per thread, so each thread computes and caches its own values
+  // and they must agree with the ones computed here
+  int n = 4;
+  std::vector<double> ws(n, 0);
+  std::vector<double> fracs(n, 0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < n; i++) {
+    threads.push_back(std::thread([&ws, &fracs, i, c, fill]() {
+      ws[i] = CosiWeight(c, THERMAL);
+      fracs[i] = AtomToMassFrac(0.5, c, fill);
+    }));
+  }
+  for (int i = 0; i < n; i++) {
+    threads[i].join();
+    EXPECT_DOUBLE_EQ(w, ws[i]);
+    EXPECT_DOUBLE_EQ(frac, fracs[i]);
+  }
+}
+
 TEST(FuelFabTests, CosiWeight_Mixed) {
   cyclus::Env::SetNucDataPath();
   double w_fill = CosiWeight(c_natu(), "thermal");
@@ -140,6 +205,21 @@ TEST(FuelFabTests, CosiWeight_Mixed) {
   EXPECT_LT(std::abs((w_target-got)/w_target), 0.00001) << "mixed composition not within 0.001% of target";
 }
 
+TEST(FuelFabTests, AtomToMassFrac) {
+  cyclus::Env::SetNucDataPath();
+  CompMap m;
+  m[id("u238")] = 2;
+  Composition::Ptr c1 = Composition::CreateFromAtom(m);
+  m.clear();
+  m[id("pu239")] = 3;
+  Composition::Ptr c2 = Composition::CreateFromAtom(m);
+
+  double m1 = 0.25 * pyne::atomic_mass(id("u238"));
+  double m2 = 0.75 * pyne::atomic_mass(id("pu239"));
+  EXPECT_DOUBLE_EQ(m1 / (m1 + m2), AtomToMassFrac(0.25, c1, c2));
+  EXPECT_DOUBLE_EQ(m2 / (m1 + m2), AtomToMassFrac(0.75, c2, c1));
+}
+
 TEST(FuelFabTests, HighFrac) {
   cyclus::Env::SetNucDataPath();
   double w_fill = CosiWeight(c_natu(), "thermal");
@@ -182,6 +262,42 @@ TEST(FuelFabTests, ValidWeights) {
   EXPECT_EQ(false, ValidWeights(w_fill, w_fiss, w_target));
 }
 
+// lot blends hit the target weight at the least cost within lot limits.
+TEST(FuelFabTests, BlendLots) {
+  // filler, a poor fissile lot and a rich fissile lot
+  std::vector<double> w;
+  w.push_back(0);
+  w.push_back(0.8);
+  w.push_back(1.2);
+  std::vector<double> mass(3, 238);
+  std::vector<double> cost;
+  cost.push_back(0);
+  cost.push_back(1);
+  cost.push_back(1);
+  std::vector<double> max_frac(3, 1);
+  std::vector<double> fracs;
+
+  // the rich lot meets the target with the least fissile material
+  EXPECT_TRUE(BlendLots(0.3, w, mass, cost, max_frac, &fracs));
+  EXPECT_NEAR(0.75, fracs[0], 1e-9);
+  EXPECT_NEAR(0, fracs[1], 1e-9);
+  EXPECT_NEAR(0.25, fracs[2], 1e-9);
+
+  // once the rich lot runs short the poor lot makes up the rest
+  max_frac[2] = 0.1;
+  EXPECT_TRUE(BlendLots(0.3, w, mass, cost, max_frac, &fracs));
+  EXPECT_NEAR(0.1, fracs[2], 1e-9);
+  EXPECT_NEAR(0.3, 0.8 * fracs[1] + 1.2 * fracs[2], 1e-9);
+  EXPECT_NEAR(1, fracs[0] + fracs[1] + fracs[2], 1e-9);
+
+  // too little fissile material or a target above every lot
+  max_frac[1] = 0.05;
+  max_frac[2] = 0.05;
+  EXPECT_FALSE(BlendLots(0.3, w, mass, cost, max_frac, &fracs));
+  max_frac.assign(3, 1);
+  EXPECT_FALSE(BlendLots(1.5, w, mass, cost, max_frac, &fracs));
+}
+
 // request (and receive) a specific recipe for fissile stream correctly.
 TEST(FuelFabTests, FissRecipe) {
   std::string config =
@@ -889,6 +1005,155 @@ TEST(FuelFabTests, HomogenousBuffers) {
   ASSERT_NO_THROW(sim.Run());
 }
 
+// blending lots meets a request from the cheapest lots that hit its weight.
+TEST(FuelFabTests, BlendSeparateLots) {
+  std::string config =
+     "<fill_commods> <val>natu</val> </fill_commods>"
+     "<fill_recipe>natu</fill_recipe>"
+     "<fill_size>100</fill_size>"
+     ""
+     "<fiss_commods> <val>stream1</val> <val>stream2</val> </fiss_commods>"
+     "<fiss_recipe>pustream</fiss_recipe>"
+     "<fiss_size>10</fiss_size>"
+     ""
+     "<outcommod>recyclefuel</outcommod>"
+     "<spectrum>thermal</spectrum>"
+     "<throughput>100</throughput>"
+     "<blend_lots>1</blend_lots>"
+     ;
+  int simdur = 3;
+  cyclus::MockSim sim(cyclus::AgentSpec(":cycamore:FuelFab"), config, simdur);
+  sim.AddSource("stream1").recipe("pustreamlow").capacity(5).Finalize();
+  sim.AddSource("stream2").recipe("pustream").capacity(5).Finalize();
+  sim.AddSource("natu").Finalize();
+  sim.AddSink("recyclefuel").recipe("uox").capacity(10).Finalize();
+  sim.AddRecipe("uox", c_uox());
+  sim.AddRecipe("pustream", c_pustream());
+  sim.AddRecipe("pustreamlow", c_pustreamlow());
+  sim.AddRecipe("natu", c_natu());
+  sim.Run();
+
+  std::vector<Cond> conds;
+  conds.push_back(Cond("Commodity", "==", std::string("recyclefuel")));
+  QueryResult qr = sim.db().Query("Transactions", &conds);
+  ASSERT_EQ(2, qr.rows.size());
+
+  Material::Ptr m = sim.GetMaterial(qr.GetVal<int>("ResourceId"));
+  EXPECT_NEAR(10, m->quantity(), cyclus::CY_NEAR_ZERO);
+  double got = CosiWeight(m->comp(), "thermal");
+  double w_target = CosiWeight(c_uox(), "thermal");
+  EXPECT_LT(std::abs((w_target-got)/w_target), 0.00001) << "mixed composition not within 0.001% of target";
+
+  // only the richer plutonium lot is used, so its isotopic vector is intact
+  CompMap cm = m->comp()->mass();
+  EXPECT_NEAR(10, cm[id("pu239")] / cm[id("pu240")], 1e-6) << "blended in the poorer fissile lot";
+}
+
+// kept fissile lots are withdrawn from in proportion to their quantities.
+TEST(FuelFabTests, KeepLots) {
+  std::string config =
+     "<fill_commods> <val>natu</val> </fill_commods>"
+     "<fill_recipe>natu</fill_recipe>"
+     "<fill_size>100</fill_size>"
+     ""
+     "<fiss_commods> <val>stream1</val> <val>stream2</val> </fiss_commods>"
+     "<fiss_recipe>pustream</fiss_recipe>"
+     "<fiss_size>10</fiss_size>"
+     ""
+     "<outcommod>recyclefuel</outcommod>"
+     "<spectrum>thermal</spectrum>"
+     "<throughput>100</throughput>"
+     "<keep_lots>1</keep_lots>"
+     ;
+  int simdur = 3;
+  cyclus::MockSim sim(cyclus::AgentSpec(":cycamore:FuelFab"), config, simdur);
+  sim.AddSource("stream1").recipe("pustreamlow").capacity(5).Finalize();
+  sim.AddSource("stream2").recipe("pustream").capacity(5).Finalize();
+  sim.AddSource("natu").Finalize();
+  sim.AddSink("recyclefuel").recipe("uox").capacity(10).Finalize();
+  sim.AddRecipe("uox", c_uox());
+  sim.AddRecipe("pustream", c_pustream());
+  sim.AddRecipe("pustreamlow", c_pustreamlow());
+  sim.AddRecipe("natu", c_natu());
+  sim.Run();
+
+  std::vector<Cond> conds;
+  conds.push_back(Cond("Commodity", "==", std::string("recyclefuel")));
+  conds.push_back(Cond("Time", "==", 1));
+  QueryResult qr = sim.db().Query("Transactions", &conds);
+  ASSERT_EQ(1, qr.rows.size());
+
+  Material::Ptr m = sim.GetMaterial(qr.GetVal<int>("ResourceId"));
+  EXPECT_NEAR(10, m->quantity(), cyclus::CY_NEAR_ZERO);
+  double got = CosiWeight(m->comp(), "thermal");
+  double w_target = CosiWeight(c_uox(), "thermal");
+  EXPECT_LT(std::abs((w_target-got)/w_target), 0.00001) << "mixed composition not within 0.001% of target";
+
+  // both 5 kg fissile lots contribute equally
+  double ratio = (100.0 / 112 + 80.0 / 92) / (10.0 / 112 + 10.0 / 92);
+  CompMap cm = m->comp()->mass();
+  EXPECT_NEAR(ratio, cm[id("pu239")] / cm[id("pu240")], 1e-6) << "fissile lots not withdrawn in proportion";
+}
+
+// two trades drain an old poor and a newer rich kept fissile lot together.
+TEST(FuelFabTests, KeepLotsDrainFiss) {
+  cyclus::Env::SetNucDataPath();
+  std::string config =
+     "<fill_commods> <val>natu</val> </fill_commods>"
+     "<fill_recipe>natu</fill_recipe>"
+     "<fill_size>10000</fill_size>"
+     ""
+     "<fiss_commods> <val>stream1</val> </fiss_commods>"
+     "<fiss_recipe>pustream</fiss_recipe>"
+     "<fiss_size>4</fiss_size>"
+     ""
+     "<outcommod>recyclefuel</outcommod>"
+     "<spectrum>thermal</spectrum>"
+     "<throughput>10000</throughput>"
+     "<keep_lots>1</keep_lots>"
+     ;
+  int simdur = 3;
+
+  Material::Ptr fissinv = Material::CreateUntracked(2, c_pustreamlow());
+  fissinv->Absorb(Material::CreateUntracked(2, c_pustream()));
+  Composition::Ptr c_fiss = fissinv->comp();
+  double w_fill = CosiWeight(c_natu(), "thermal");
+  double w_fiss = CosiWeight(c_fiss, "thermal");
+  double w_target = CosiWeight(c_uox(), "thermal");
+  double fiss_frac = HighFrac(w_fill, w_target, w_fiss);
+  fiss_frac = AtomToMassFrac(fiss_frac, c_fiss, c_natu());
+  double max_provide = fissinv->quantity() / fiss_frac;
+
+  cyclus::MockSim sim(cyclus::AgentSpec(":cycamore:FuelFab"), config, simdur);
+  sim.AddSource("stream1").recipe("pustreamlow").capacity(2).lifetime(1).Finalize();
+  sim.AddSource("stream1").recipe("pustream").capacity(2).start(1).lifetime(1).Finalize();
+  sim.AddSource("natu").lifetime(1).Finalize();
+  sim.AddSink("recyclefuel").recipe("uox").capacity(0.75 * max_provide).start(2).lifetime(1).Finalize();
+  sim.AddSink("recyclefuel").recipe("uox").capacity(0.75 * max_provide).start(2).lifetime(1).Finalize();
+  sim.AddRecipe("uox", c_uox());
+  sim.AddRecipe("pustream", c_pustream());
+  sim.AddRecipe("pustreamlow", c_pustreamlow());
+  sim.AddRecipe("natu", c_natu());
+  ASSERT_NO_THROW(sim.Run());
+
+  std::vector<Cond> conds;
+  conds.push_back(Cond("Commodity", "==", std::string("recyclefuel")));
+  QueryResult qr = sim.db().Query("Transactions", &conds);
+  ASSERT_EQ(2, qr.rows.size());
+
+  double ratio = (100.0 / 112 + 80.0 / 92) / (10.0 / 112 + 10.0 / 92);
+  double tot = 0;
+  for (int i = 0; i < qr.rows.size(); i++) {
+    Material::Ptr m = sim.GetMaterial(qr.GetVal<int>("ResourceId", i));
+    tot += m->quantity();
+    double got = CosiWeight(m->comp(), "thermal");
+    EXPECT_LT(std::abs((w_target-got)/w_target), 0.00001) << "mixed composition not within 0.001% of target";
+    CompMap cm = m->comp()->mass();
+    EXPECT_NEAR(ratio, cm[id("pu239")] / cm[id("pu240")], 1e-6) << "fissile lots not withdrawn in proportion";
+  }
+  EXPECT_NEAR(max_provide, tot, 1e-6) << "fissile inventory not drained";
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 TEST(FuelFabTests, PositionInitialize) {
   cyclus::Env::SetNucDataPath();
@@ -1,5 +1,8 @@
 #include "reactor.h"
 
+#include <algorithm>
+#include <cmath>
+
 using cyclus::Material;
 using cyclus::toolkit::MatVec;
 using cyclus::KeyError;
@@ -8,20 +11,146 @@ using cyclus::Request;
 
 namespace cycamore {
 
+// indexed by Reactor::Event
+static const std::string kEventNames[] = {
+  "CYCLE_START", "CYCLE_END", "LOAD", "DISCHARGE", "DISCHARGE_FAILED",
+  "TRANSMUTE", "RETIRED",
+};
+
+// Burnups closer than this (MWd/kg) share a cached spent fuel composition
+static const double kBurnupTol = 1e-3;
+
+// the burnup model cache is cleared when it grows beyond this many entries,
+// to stay bounded when burnups keep drifting
+static const int kMaxBurnComps = 4096;
+
+InterpBurnupModel::InterpBurnupModel(
+    const std::vector<double>& enrichments,
+    const std::vector<double>& burnups,
+    const std::vector<cyclus::Composition::Ptr>& comps)
+    : enrichments_(enrichments),
+      burnups_(burnups) {
+  std::set<cyclus::Nuc> nucs;
+  for (int i = 0; i < comps.size(); i++) {
+    const cyclus::CompMap& cm = comps[i]->mass();
+    cyclus::CompMap::const_iterator it;
+    for (it = cm.begin(); it != cm.end(); ++it) {
+      nucs.insert(it->first);
+    }
+  }
+  nucs_.assign(nucs.begin(), nucs.end());
+
+  for (int i = 0; i < comps.size(); i++) {
+    cyclus::CompMap cm = comps[i]->mass();
+    cyclus::compmath::Normalize(&cm);
+    std::vector<double> fracs(nucs_.size(), 0);
+    for (int j = 0; j < nucs_.size(); j++) {
+      cyclus::CompMap::iterator it = cm.find(nucs_[j]);
+      if (it != cm.end()) {
+        fracs[j] = it->second;
+      }
+    }
+    table_.push_back(fracs);
+  }
+}
+
+cyclus::Composition::Ptr InterpBurnupModel::Burn(
+    cyclus::Composition::Ptr fresh, double burnup) {
+  long long bucket = std::llround(burnup / kBurnupTol);
+  std::pair<int, long long> key(fresh->id(), bucket);
+  std::map<std::pair<int, long long>, cyclus::Composition::Ptr>::iterator
+      cached = cache_.find(key);
+  if (cached != cache_.end()) {
+    return cached->second;
+  }
+  if (cache_.size() >= kMaxBurnComps) {
+    cache_.clear();
+  }
+  // every burnup in a bucket gets the composition of the bucket's burnup
+  burnup = bucket * kBurnupTol;
+
+  double u235 = 0;
+  double u = 0;
+  const cyclus::CompMap& cm = fresh->mass();
+  cyclus::CompMap::const_iterator it;
+  for (it = cm.begin(); it != cm.end(); ++it) {
+    if (pyne::nucname::znum(it->first) == 92) {
+      u += it->second;
+      if (pyne::nucname::anum(it->first) == 235) {
+        u235 += it->second;
+      }
+    }
+  }
+  double enrich = u > 0 ? u235 / u : 0;
+
+  double fe;
+  double fb;
+  int ie = Locate(enrichments_, enrich, &fe);
+  int ib = Locate(burnups_, burnup, &fb);
+  int ne = enrichments_.size() > 1 ? 1 : 0;
+  int nb = burnups_.size() > 1 ? 1 : 0;
+  int nburn = burnups_.size();
+  const std::vector<double>& c00 = table_[ie * nburn + ib];
+  const std::vector<double>& c01 = table_[ie * nburn + ib + nb];
+  const std::vector<double>& c10 = table_[(ie + ne) * nburn + ib];
+  const std::vector<double>& c11 = table_[(ie + ne) * nburn + ib + nb];
+
+  cyclus::CompMap spent;
+  for (int j = 0; j < nucs_.size(); j++) {
+    double v = (1 - fe) * ((1 - fb) * c00[j] + fb * c01[j]) +
+               fe * ((1 - fb) * c10[j] + fb * c11[j]);
+    if (v > 0) {
+      spent[nucs_[j]] = v;
+    }
+  }
+
+  cyclus::Composition::Ptr c = cyclus::Composition::CreateFromMass(spent);
+  cache_[key] = c;
+  return c;
+}
+
+int InterpBurnupModel::Locate(const std::vector<double>& grid, double x,
+                              double* frac) {
+  *frac = 0;
+  if (grid.size() < 2 || x <= grid.front()) {
+    return 0;
+  }
+  int last = grid.size() - 2;
+  if (x >= grid.back()) {
+    *frac = 1;
+    return last;
+  }
+
+  int i = std::upper_bound(grid.begin(), grid.end(), x) - grid.begin() - 1;
+  *frac = (x - grid[i]) / (grid[i + 1] - grid[i]);
+  return i;
+}
+
 Reactor::Reactor(cyclus::Context* ctx)
     : cyclus::Facility(ctx),
-      n_assem_batch(0),
       assem_size(0),
+      n_assem_batch(0),
       n_assem_core(0),
-      n_assem_spent(0),
       n_assem_fresh(0),
+      n_assem_spent(0),
+      batch_requests(false),
       cycle_time(0),
       refuel_time(0),
       cycle_step(0),
       power_cap(0),
       power_name("power"),
+      record_power_intervals(false),
+      power_interval_start(-1),
+      power_interval_on(false),
+      record_events(true),
+      burnup_model("recipe"),
+      thermal_efficiency(0.33),
+      keep_packaging(true),
       discharged(false),
-      keep_packaging(true) {}
+      assems_indexed_(false),
+      changes_scheduled_(false),
+      idle_until_(-1),
+      spent_indexed_(false) {}
 
 
 #pragma cyclus def clone cycamore::Reactor
@@ -41,6 +170,7 @@ Reactor::Reactor(cyclus::Context* ctx)
 void Reactor::InitFrom(Reactor* m) {
   #pragma cyclus impl initfromcopy cycamore::Reactor
   cyclus::toolkit::CommodityProducer::Copy(m);
+  burnup_model_ = m->burnup_model_ptr();
 }
 
 void Reactor::InitFrom(cyclus::QueryableBackend* b) {
@@ -95,6 +225,32 @@ void Reactor::EnterNotify() {
        << " recipe_change_out vals, expected " << n << "\n";
   }
 
+  if (burnup_model == "interpolate") {
+    int ngrid = burnup_enrichments.size() * burnup_burnups.size();
+    if (ngrid == 0 || burnup_recipes.size() != ngrid) {
+      ss << "prototype '" << prototype() << "' has " << burnup_recipes.size()
+         << " burnup_recipes vals, expected one per burnup_enrichments and "
+         << "burnup_burnups pair (" << ngrid << ")\n";
+    }
+    for (int i = 1; i < burnup_enrichments.size(); i++) {
+      if (burnup_enrichments[i] <= burnup_enrichments[i - 1]) {
+        ss << "prototype '" << prototype()
+           << "' has burnup_enrichments that are not ascending\n";
+        break;
+      }
+    }
+    for (int i = 1; i < burnup_burnups.size(); i++) {
+      if (burnup_burnups[i] <= burnup_burnups[i - 1]) {
+        ss << "prototype '" << prototype()
+           << "' has burnup_burnups that are not ascending\n";
+        break;
+      }
+    }
+  } else if (burnup_model != "recipe") {
+    ss << "prototype '" << prototype() << "' has unknown burnup_model '"
+       << burnup_model << "'\n";
+  }
+
   n = pref_change_times.size();
   if (pref_change_commods.size() != n) {
     ss << "prototype '" << prototype() << "' has " << pref_change_commods.size()
@@ -108,14 +264,45 @@ void Reactor::EnterNotify() {
   if (ss.str().size() > 0) {
     throw ValueError(ss.str());
   }
-  
+
+  ScheduleChanges();
+
   InitializePosition();
 }
 
+void Reactor::ScheduleChanges() {
+  // changes for commodities the reactor doesn't request are ignored.
+  pref_changes_.clear();
+  for (int i = 0; i < pref_change_times.size(); i++) {
+    int j = fuel_slot(pref_change_commods[i]);
+    if (j >= 0) {
+      pref_changes_.insert(std::make_pair(pref_change_times[i],
+                                          std::make_pair(j, i)));
+    }
+  }
+  next_pref_change_ = pref_changes_.begin();
+
+  recipe_changes_.clear();
+  for (int i = 0; i < recipe_change_times.size(); i++) {
+    int j = fuel_slot(recipe_change_commods[i]);
+    if (j >= 0) {
+      recipe_changes_.insert(std::make_pair(recipe_change_times[i],
+                                            std::make_pair(j, i)));
+    }
+  }
+  next_recipe_change_ = recipe_changes_.begin();
+  changes_scheduled_ = true;
+}
+
 bool Reactor::CheckDecommissionCondition() {
   return core.count() == 0 && spent.count() == 0;
 }
 
+void Reactor::Decommission() {
+  RecordPowerInterval(context()->time() + 1);
+  cyclus::Facility::Decommission();
+}
+
 void Reactor::Tick() {
   // The following code must go in the Tick so they fire on the time step
   // following the cycle_step update - allowing for the all reactor events to
@@ -124,8 +311,12 @@ void Reactor::Tick() {
   // can't go at the beginnin of the Tock is so that resource exchange has a
   // chance to occur after the discharge on this same time step.
 
+  if (context()->time() < idle_until_) {
+    return;
+  }
+
   if (retired()) {
-    Record("RETIRED", "");
+    Record(RETIRED);
 
     if (context()->time() == exit_time() + 1) { // only need to transmute once
       if (decom_transmute_all == true) {
@@ -144,7 +335,7 @@ void Reactor::Tick() {
     // burn a batch from fresh inventory on this time step.  When retired,
     // this batch also needs to be discharged to spent fuel inventory.
     while (fresh.count() > 0 && spent.space() >= assem_size) {
-      spent.Push(fresh.Pop());
+      PushSpent(MatVec(1, fresh.Pop()));
     }
     if(CheckDecommissionCondition()) {
       context()->SchedDecom(this);    
@@ -154,7 +345,7 @@ void Reactor::Tick() {
 
   if (cycle_step == cycle_time) {
     Transmute();
-    Record("CYCLE_END", "");
+    Record(CYCLE_END);
   }
 
   if (cycle_step >= cycle_time && !discharged) {
@@ -165,46 +356,46 @@ void Reactor::Tick() {
   }
 
   int t = context()->time();
+  if (!changes_scheduled_) {
+    ScheduleChanges();
+  }
 
-  // update preferences
-  for (int i = 0; i < pref_change_times.size(); i++) {
-    int change_t = pref_change_times[i];
-    if (t != change_t) {
-      continue;
-    }
-
-    std::string incommod = pref_change_commods[i];
-    for (int j = 0; j < fuel_incommods.size(); j++) {
-      if (fuel_incommods[j] == incommod) {
-        fuel_prefs[j] = pref_change_values[i];
-        break;
-      }
+  // update preferences - changes scheduled for earlier time steps (e.g.
+  // before a restart) are skipped.
+  while (next_pref_change_ != pref_changes_.end() &&
+         next_pref_change_->first <= t) {
+    if (next_pref_change_->first == t) {
+      int j = next_pref_change_->second.first;
+      int i = next_pref_change_->second.second;
+      fuel_prefs[j] = pref_change_values[i];
     }
+    ++next_pref_change_;
   }
 
   // update recipes
-  for (int i = 0; i < recipe_change_times.size(); i++) {
-    int change_t = recipe_change_times[i];
-    if (t != change_t) {
-      continue;
-    }
-
-    std::string incommod = recipe_change_commods[i];
-    for (int j = 0; j < fuel_incommods.size(); j++) {
-      if (fuel_incommods[j] == incommod) {
-        fuel_inrecipes[j] = recipe_change_in[i];
-        fuel_outrecipes[j] = recipe_change_out[i];
-        break;
+  while (next_recipe_change_ != recipe_changes_.end() &&
+         next_recipe_change_->first <= t) {
+    if (next_recipe_change_->first == t) {
+      int j = next_recipe_change_->second.first;
+      int i = next_recipe_change_->second.second;
+      fuel_inrecipes[j] = recipe_change_in[i];
+      fuel_outrecipes[j] = recipe_change_out[i];
+      if (j < fuel_incomps_.size()) {
+        fuel_incomps_[j].reset();
+        fuel_outcomps_[j].reset();
       }
     }
+    ++next_recipe_change_;
   }
 }
 
 std::set<cyclus::RequestPortfolio<Material>::Ptr> Reactor::GetMatlRequests() {
   using cyclus::RequestPortfolio;
-
   std::set<RequestPortfolio<Material>::Ptr> ports;
-  Material::Ptr m;
+
+  if (context()->time() < idle_until_) {
+    return ports;
+  }
 
   // second min expression reduces assembles to amount needed until
   // retirement if it is near.
@@ -228,22 +419,52 @@ std::set<cyclus::RequestPortfolio<Material>::Ptr> Reactor::GetMatlRequests() {
     return ports;
   }
 
-  for (int i = 0; i < n_assem_order; i++) {
+  // every assembly requested is identical, so a single target per fuel slot
+  // is shared by all portfolios.
+  MatVec targets;
+  for (int j = 0; j < fuel_incommods.size(); j++) {
+    targets.push_back(Material::CreateUntracked(assem_size, fuel_incomp(j)));
+  }
+
+  std::vector<double>::iterator result;
+  result = std::max_element(fuel_prefs.begin(), fuel_prefs.end());
+  int max_index = std::distance(fuel_prefs.begin(), result);
+
+  if (batch_requests) {
+    // a single exclusive request per fuel slot for the whole order.  An
+    // exclusive request is filled with the smaller of the order and the bid,
+    // so AdjustMatlPrefs drops bids for less than the order that are not a
+    // whole number of assemblies.
     RequestPortfolio<Material>::Ptr port(new RequestPortfolio<Material>());
     std::vector<Request<Material>*> mreqs;
     for (int j = 0; j < fuel_incommods.size(); j++) {
-      std::string commod = fuel_incommods[j];
-      double pref = fuel_prefs[j];
-      cyclus::Composition::Ptr recipe = context()->GetRecipe(fuel_inrecipes[j]);
-      m = Material::CreateUntracked(assem_size, recipe);
-
-      Request<Material>* r = port->AddRequest(m, this, commod, pref, true);
+      Material::Ptr m = Material::CreateUntracked(n_assem_order * assem_size,
+                                                  fuel_incomp(j));
+      Request<Material>* r = port->AddRequest(m, this, fuel_incommods[j],
+                                              fuel_prefs[j], true);
       mreqs.push_back(r);
     }
 
-    std::vector<double>::iterator result;
-    result = std::max_element(fuel_prefs.begin(), fuel_prefs.end());
-    int max_index = std::distance(fuel_prefs.begin(), result);
+    // one demand row per assembly, as when requesting assemblies separately
+    for (int i = 0; i < n_assem_order; i++) {
+      cyclus::toolkit::RecordTimeSeries<double>(
+          "demand" + fuel_incommods[max_index], this, assem_size);
+    }
+
+    port->AddMutualReqs(mreqs);
+    ports.insert(port);
+    return ports;
+  }
+
+  for (int i = 0; i < n_assem_order; i++) {
+    RequestPortfolio<Material>::Ptr port(new RequestPortfolio<Material>());
+    std::vector<Request<Material>*> mreqs;
+    for (int j = 0; j < fuel_incommods.size(); j++) {
+      Request<Material>* r = port->AddRequest(targets[j], this,
+                                              fuel_incommods[j], fuel_prefs[j],
+                                              true);
+      mreqs.push_back(r);
+    }
 
     cyclus::toolkit::RecordTimeSeries<double>("demand"+fuel_incommods[max_index], this,
                                           assem_size) ;
@@ -260,16 +481,19 @@ void Reactor::GetMatlTrades(
     std::vector<std::pair<cyclus::Trade<Material>, Material::Ptr> >&
         responses) {
   using cyclus::Trade;
-
-  std::map<std::string, MatVec> mats = PopSpent();
+  IndexSpent();
+  MatVec traded;
   for (int i = 0; i < trades.size(); i++) {
     std::string commod = trades[i].request->commodity();
-    Material::Ptr m = mats[commod].back();
-    mats[commod].pop_back();
+    // trade away oldest assemblies first
+    std::deque<Material::Ptr>& mats = spent_index_[commod];
+    Material::Ptr m = mats.front();
+    mats.pop_front();
+    traded.push_back(m);
     responses.push_back(std::make_pair(trades[i], m));
-    res_indexes.erase(m->obj_id());
+    unindex_res(m);
   }
-  PushSpent(mats);  // return leftovers back to spent buffer
+  PopSpent(traded);
 }
 
 void Reactor::AcceptMatlTrades(const std::vector<
@@ -277,22 +501,69 @@ void Reactor::AcceptMatlTrades(const std::vector<
   std::vector<std::pair<cyclus::Trade<Material>,
                         Material::Ptr> >::const_iterator trade;
 
-  std::stringstream ss;
-  int nload = std::min((int)responses.size(), n_assem_core - core.count());
-  if (nload > 0) {
-    ss << nload << " assemblies";
-    Record("LOAD", ss.str());
-  }
-
+  MatVec assems;
+  std::vector<std::string> commods;
   for (trade = responses.begin(); trade != responses.end(); ++trade) {
     std::string commod = trade->first.request->commodity();
     Material::Ptr m = trade->second;
-    index_res(m, commod);
+    if (batch_requests) {
+      // split whole batch orders into individual assemblies - round-off
+      // stays with the last assembly.
+      double n_assem = m->quantity() / assem_size;
+      int n = static_cast<int>(round(n_assem));
+      if (n < 1 || std::abs(n_assem - n) * assem_size > cyclus::eps_rsrc()) {
+        std::stringstream ss;
+        ss << "prototype '" << prototype() << "' received " << m->quantity()
+           << " kg of " << commod << ", not a whole number of "
+           << assem_size << " kg assemblies";
+        throw ValueError(ss.str());
+      }
+      for (int i = 0; i < n - 1; i++) {
+        assems.push_back(m->ExtractQty(assem_size));
+        commods.push_back(commod);
+      }
+    }
+    assems.push_back(m);
+    commods.push_back(commod);
+  }
 
+  for (int i = 0; i < assems.size(); i++) {
+    index_res(assems[i], commods[i]);
+  }
+
+  int nload = std::min((int)assems.size(), n_assem_core - core.count());
+  if (nload > 0) {
+    Record(LOAD, MatVec(assems.begin(), assems.begin() + nload));
+  }
+
+  for (int i = 0; i < assems.size(); i++) {
     if (core.count() < n_assem_core) {
-      core.Push(m);
+      core.Push(assems[i]);
     } else {
-      fresh.Push(m);
+      fresh.Push(assems[i]);
+    }
+  }
+}
+
+void Reactor::AdjustMatlPrefs(cyclus::PrefMap<Material>::type& prefs) {
+  if (!batch_requests) {
+    return;
+  }
+
+  cyclus::PrefMap<Material>::type::iterator it;
+  for (it = prefs.begin(); it != prefs.end(); ++it) {
+    double order = it->first->target()->quantity();
+    std::map<cyclus::Bid<Material>*, double>::iterator bit;
+    for (bit = it->second.begin(); bit != it->second.end(); ++bit) {
+      double qty = bit->first->offer()->quantity();
+      if (qty >= order - cyclus::eps_rsrc()) {
+        continue;
+      }
+      double n_assem = qty / assem_size;
+      double n = round(n_assem);
+      if (n < 1 || std::abs(n_assem - n) * assem_size > cyclus::eps_rsrc()) {
+        bit->second = -1;  // negative preferences remove the arc
+      }
     }
   }
 }
@@ -302,8 +573,9 @@ std::set<cyclus::BidPortfolio<Material>::Ptr> Reactor::GetMatlBids(
   using cyclus::BidPortfolio;
   std::set<BidPortfolio<Material>::Ptr> ports;
 
-  bool gotmats = false;
-  std::map<std::string, MatVec> all_mats;
+  if (spent.count() == 0) {
+    return ports;
+  }
 
   if (uniq_outcommods_.empty()) {
     for (int i = 0; i < fuel_outcommods.size(); i++) {
@@ -317,14 +589,15 @@ std::set<cyclus::BidPortfolio<Material>::Ptr> Reactor::GetMatlBids(
     std::vector<Request<Material>*>& reqs = commod_requests[commod];
     if (reqs.size() == 0) {
       continue;
-    } else if (!gotmats) {
-      all_mats = PeekSpent();
     }
 
-    MatVec mats = all_mats[commod];
-    if (mats.size() == 0) {
+    IndexSpent();
+    std::map<std::string, std::deque<Material::Ptr> >::iterator found =
+        spent_index_.find(commod);
+    if (found == spent_index_.end() || found->second.empty()) {
       continue;
     }
+    const std::deque<Material::Ptr>& mats = found->second;
 
     BidPortfolio<Material>::Ptr port(new BidPortfolio<Material>());
 
@@ -358,7 +631,13 @@ void Reactor::Tock() {
   if (retired()) {
     return;
   }
-  
+
+  if (context()->time() < idle_until_) {
+    RecordPower(true);
+    cycle_step++;
+    return;
+  }
+
   // Check that irradiation and refueling periods are over, that 
   // the core is full and that fuel was successfully discharged in this refueling time.
   // If this is the case, then a new cycle will be initiated.
@@ -368,25 +647,43 @@ void Reactor::Tock() {
   }
 
   if (cycle_step == 0 && core.count() == n_assem_core) {
-    Record("CYCLE_START", "");
+    Record(CYCLE_START);
   }
 
-  if (cycle_step >= 0 && cycle_step < cycle_time &&
-      core.count() == n_assem_core) {
-    cyclus::toolkit::RecordTimeSeries<cyclus::toolkit::POWER>(this, power_cap);
-    cyclus::toolkit::RecordTimeSeries<double>("supplyPOWER", this, power_cap);
-    RecordSideProduct(true);
-  } else {
-    cyclus::toolkit::RecordTimeSeries<cyclus::toolkit::POWER>(this, 0);
-    cyclus::toolkit::RecordTimeSeries<double>("supplyPOWER", this, 0);
-    RecordSideProduct(false);
-  }
+  RecordPower(cycle_step >= 0 && cycle_step < cycle_time &&
+              core.count() == n_assem_core);
 
   // "if" prevents starting cycle after initial deployment until core is full
   // even though cycle_step is its initial zero.
   if (cycle_step > 0 || core.count() == n_assem_core) {
     cycle_step++;
   }
+
+  UpdateIdle();
+}
+
+void Reactor::UpdateIdle() {
+  idle_until_ = -1;
+  if (core.count() != n_assem_core || fresh.count() != n_assem_fresh ||
+      spent.count() > 0 || cycle_step >= cycle_time || !changes_scheduled_) {
+    return;
+  }
+
+  // the cycle ends on the Tick where cycle_step reaches cycle_time.
+  int t = context()->time();
+  int until = t + 1 + cycle_time - cycle_step;
+  if (next_pref_change_ != pref_changes_.end()) {
+    until = std::min(until, next_pref_change_->first);
+  }
+  if (next_recipe_change_ != recipe_changes_.end()) {
+    until = std::min(until, next_recipe_change_->first);
+  }
+  if (exit_time() != -1) {
+    until = std::min(until, exit_time() + 1);
+  }
+  if (until > t + 1) {
+    idle_until_ = until;
+  }
 }
 
 void Reactor::Transmute() { Transmute(n_assem_batch); }
@@ -399,46 +696,56 @@ void Reactor::Transmute(int n_assem) {
     core.Push(core.PopN(core.count() - old.size()));
   }
 
-  std::stringstream ss;
-  ss << old.size() << " assemblies";
-  Record("TRANSMUTE", ss.str());
+  Record(TRANSMUTE, old);
 
+  BurnupModel::Ptr model = burnup_model_ptr();
+  double burnup = model ? DischargeBurnup() : 0;
   for (int i = 0; i < old.size(); i++) {
-    old[i]->Transmute(context()->GetRecipe(fuel_outrecipe(old[i])));
+    if (model) {
+      old[i]->Transmute(model->Burn(old[i]->comp(), burnup));
+    } else {
+      old[i]->Transmute(fuel_outcomp(assem_slots[assem_row(old[i])]));
+    }
   }
 }
 
-std::map<std::string, MatVec> Reactor::PeekSpent() {
-  std::map<std::string, MatVec> mapped;
-  MatVec mats = spent.PopN(spent.count());
-  spent.Push(mats);
-  for (int i = 0; i < mats.size(); i++) {
-    std::string commod = fuel_outcommod(mats[i]);
-    mapped[commod].push_back(mats[i]);
+BurnupModel::Ptr Reactor::burnup_model_ptr() {
+  if (burnup_model_ || burnup_model != "interpolate") {
+    return burnup_model_;
+  }
+
+  std::vector<cyclus::Composition::Ptr> comps;
+  for (int i = 0; i < burnup_recipes.size(); i++) {
+    comps.push_back(context()->GetRecipe(burnup_recipes[i]));
   }
-  return mapped;
+  burnup_model_ = BurnupModel::Ptr(
+      new InterpBurnupModel(burnup_enrichments, burnup_burnups, comps));
+  return burnup_model_;
+}
+
+double Reactor::DischargeBurnup() {
+  // all thermal energy produced during a cycle is attributed to the batch
+  // discharged at its end.
+  double days = cycle_time * context()->dt() / 86400.0;
+  return power_cap / thermal_efficiency * days / (n_assem_batch * assem_size);
 }
 
 bool Reactor::Discharge() {
   int npop = std::min(n_assem_batch, core.count());
   if (n_assem_spent - spent.count() < npop) {
-    Record("DISCHARGE", "failed");
+    Record(DISCHARGE_FAILED);
     return false;  // not enough room in spent buffer
   }
 
-  std::stringstream ss;
-  ss << npop << " assemblies";
-  Record("DISCHARGE", ss.str());
-  spent.Push(core.PopN(npop));
+  MatVec mats = core.PopN(npop);
+  Record(DISCHARGE, mats);
+  PushSpent(mats);
 
-  std::map<std::string, MatVec> spent_mats;
   for (int i = 0; i < fuel_outcommods.size(); i++) {
-    spent_mats = PeekSpent();
-    MatVec mats = spent_mats[fuel_outcommods[i]];
+    const std::deque<Material::Ptr>& mats = spent_index_[fuel_outcommods[i]];
     double tot_spent = 0;
-    for (int j = 0; j<mats.size(); j++){
-      Material::Ptr m = mats[j];
-      tot_spent += m->quantity();
+    for (int j = 0; j < mats.size(); j++) {
+      tot_spent += mats[j]->quantity();
     }
     cyclus::toolkit::RecordTimeSeries<double>("supply"+fuel_outcommods[i], this, tot_spent);
   }
@@ -452,87 +759,257 @@ void Reactor::Load() {
     return;
   }
 
-  std::stringstream ss;
-  ss << n << " assemblies";
-  Record("LOAD", ss.str());
-  core.Push(fresh.PopN(n));
+  MatVec mats = fresh.PopN(n);
+  Record(LOAD, mats);
+  core.Push(mats);
 }
 
-std::string Reactor::fuel_incommod(Material::Ptr m) {
-  int i = res_indexes[m->obj_id()];
+const std::string& Reactor::fuel_incommod(Material::Ptr m) {
+  int i = assem_slots[assem_row(m)];
   if (i >= fuel_incommods.size()) {
     throw KeyError("cycamore::Reactor - no incommod for material object");
   }
   return fuel_incommods[i];
 }
 
-std::string Reactor::fuel_outcommod(Material::Ptr m) {
-  int i = res_indexes[m->obj_id()];
+const std::string& Reactor::fuel_outcommod(Material::Ptr m) {
+  int i = assem_slots[assem_row(m)];
   if (i >= fuel_outcommods.size()) {
     throw KeyError("cycamore::Reactor - no outcommod for material object");
   }
   return fuel_outcommods[i];
 }
 
-std::string Reactor::fuel_inrecipe(Material::Ptr m) {
-  int i = res_indexes[m->obj_id()];
+const std::string& Reactor::fuel_inrecipe(Material::Ptr m) {
+  int i = assem_slots[assem_row(m)];
   if (i >= fuel_inrecipes.size()) {
     throw KeyError("cycamore::Reactor - no inrecipe for material object");
   }
   return fuel_inrecipes[i];
 }
 
-std::string Reactor::fuel_outrecipe(Material::Ptr m) {
-  int i = res_indexes[m->obj_id()];
+const std::string& Reactor::fuel_outrecipe(Material::Ptr m) {
+  int i = assem_slots[assem_row(m)];
   if (i >= fuel_outrecipes.size()) {
     throw KeyError("cycamore::Reactor - no outrecipe for material object");
   }
   return fuel_outrecipes[i];
 }
 
+cyclus::Composition::Ptr Reactor::fuel_incomp(int i) {
+  if (i >= fuel_inrecipes.size()) {
+    throw KeyError("cycamore::Reactor - no inrecipe for fuel slot");
+  }
+  if (fuel_incomps_.size() != fuel_inrecipes.size()) {
+    fuel_incomps_.assign(fuel_inrecipes.size(), cyclus::Composition::Ptr());
+    fuel_outcomps_.assign(fuel_inrecipes.size(), cyclus::Composition::Ptr());
+  }
+  if (!fuel_incomps_[i]) {
+    fuel_incomps_[i] = context()->GetRecipe(fuel_inrecipes[i]);
+  }
+  return fuel_incomps_[i];
+}
+
+cyclus::Composition::Ptr Reactor::fuel_outcomp(int i) {
+  if (i >= fuel_outrecipes.size()) {
+    throw KeyError("cycamore::Reactor - no outrecipe for fuel slot");
+  }
+  if (fuel_outcomps_.size() != fuel_inrecipes.size()) {
+    fuel_incomps_.assign(fuel_inrecipes.size(), cyclus::Composition::Ptr());
+    fuel_outcomps_.assign(fuel_inrecipes.size(), cyclus::Composition::Ptr());
+  }
+  if (!fuel_outcomps_[i]) {
+    fuel_outcomps_[i] = context()->GetRecipe(fuel_outrecipes[i]);
+  }
+  return fuel_outcomps_[i];
+}
+
 double Reactor::fuel_pref(Material::Ptr m) {
-  int i = res_indexes[m->obj_id()];
+  int i = assem_slots[assem_row(m)];
   if (i >= fuel_prefs.size()) {
     return 0;
   }
   return fuel_prefs[i];
 }
 
-void Reactor::index_res(cyclus::Resource::Ptr m, std::string incommod) {
+int Reactor::fuel_slot(const std::string& incommod) {
   for (int i = 0; i < fuel_incommods.size(); i++) {
     if (fuel_incommods[i] == incommod) {
-      res_indexes[m->obj_id()] = i;
-      return;
+      return i;
     }
   }
-  throw ValueError(
-      "cycamore::Reactor - received unsupported incommod material");
+  return -1;
 }
 
-std::map<std::string, MatVec> Reactor::PopSpent() {
+void Reactor::index_res(cyclus::Resource::Ptr m, std::string incommod) {
+  int i = fuel_slot(incommod);
+  if (i < 0) {
+    throw ValueError(
+        "cycamore::Reactor - received unsupported incommod material");
+  }
+
+  IndexAssems();
+  int row;
+  if (free_rows_.empty()) {
+    row = assem_ids.size();
+    assem_ids.push_back(m->obj_id());
+    assem_slots.push_back(i);
+  } else {
+    row = free_rows_.back();
+    free_rows_.pop_back();
+    assem_ids[row] = m->obj_id();
+    assem_slots[row] = i;
+  }
+  assem_rows_[m->obj_id()] = row;
+}
+
+void Reactor::unindex_res(cyclus::Resource::Ptr m) {
+  IndexAssems();
+  std::unordered_map<int, int>::iterator it = assem_rows_.find(m->obj_id());
+  if (it == assem_rows_.end()) {
+    return;
+  }
+  assem_ids[it->second] = -1;
+  free_rows_.push_back(it->second);
+  assem_rows_.erase(it);
+}
+
+int Reactor::assem_row(cyclus::Resource::Ptr m) {
+  IndexAssems();
+  std::unordered_map<int, int>::iterator it = assem_rows_.find(m->obj_id());
+  if (it == assem_rows_.end()) {
+    throw KeyError("cycamore::Reactor - no fuel info for material object");
+  }
+  return it->second;
+}
+
+void Reactor::IndexAssems() {
+  if (assems_indexed_) {
+    return;
+  }
+
+  assem_rows_.clear();
+  free_rows_.clear();
+  for (int i = 0; i < assem_ids.size(); i++) {
+    if (assem_ids[i] == -1) {
+      free_rows_.push_back(i);
+    } else {
+      assem_rows_[assem_ids[i]] = i;
+    }
+  }
+  assems_indexed_ = true;
+}
+
+void Reactor::IndexSpent() {
+  if (spent_indexed_) {
+    return;
+  }
+
+  spent_index_.clear();
   MatVec mats = spent.PopN(spent.count());
-  std::map<std::string, MatVec> mapped;
+  spent.Push(mats);
   for (int i = 0; i < mats.size(); i++) {
-    std::string commod = fuel_outcommod(mats[i]);
-    mapped[commod].push_back(mats[i]);
+    spent_index_[fuel_outcommod(mats[i])].push_back(mats[i]);
   }
+  spent_indexed_ = true;
+}
 
-  // needed so we trade away oldest assemblies first
-  std::map<std::string, MatVec>::iterator it;
-  for (it = mapped.begin(); it != mapped.end(); ++it) {
-    std::reverse(it->second.begin(), it->second.end());
+void Reactor::PushSpent(MatVec mats) {
+  IndexSpent();
+  spent.Push(mats);
+  for (int i = 0; i < mats.size(); i++) {
+    spent_index_[fuel_outcommod(mats[i])].push_back(mats[i]);
   }
+}
 
-  return mapped;
+void Reactor::PopSpent(const MatVec& mats) {
+  if (mats.empty()) {
+    return;
+  }
+
+  std::set<int> ids;
+  for (int i = 0; i < mats.size(); i++) {
+    ids.insert(mats[i]->obj_id());
+  }
+
+  // Traded assemblies are always the oldest of their outcommod, so with a
+  // single outcommod (the common case) they sit at the front of the buffer.
+  MatVec popped = spent.PopN(mats.size());
+  bool front_only = true;
+  for (int i = 0; i < popped.size(); i++) {
+    if (ids.count(popped[i]->obj_id()) == 0) {
+      front_only = false;
+      break;
+    }
+  }
+  if (front_only) {
+    return;
+  }
+
+  MatVec rest = spent.PopN(spent.count());
+  popped.insert(popped.end(), rest.begin(), rest.end());
+  MatVec keep;
+  for (int i = 0; i < popped.size(); i++) {
+    if (ids.count(popped[i]->obj_id()) == 0) {
+      keep.push_back(popped[i]);
+    }
+  }
+  spent.Push(keep);
 }
 
-void Reactor::PushSpent(std::map<std::string, MatVec> leftover) {
-  std::map<std::string, MatVec>::iterator it;
-  for (it = leftover.begin(); it != leftover.end(); ++it) {
-    // undo reverse in PopSpent to make sure oldest assemblies come out first
-    std::reverse(it->second.begin(), it->second.end());
-    spent.Push(it->second);
+void Reactor::RecordPower(bool produce) {
+  if (!record_power_intervals) {
+    double value = produce ? power_cap : 0;
+    cyclus::toolkit::RecordTimeSeries<cyclus::toolkit::POWER>(this, value);
+    cyclus::toolkit::RecordTimeSeries<double>("supplyPOWER", this, value);
+    RecordSideProduct(produce);
+    return;
   }
+
+  int t = context()->time();
+  if (power_interval_start >= 0 && produce != power_interval_on) {
+    RecordPowerInterval(t);
+  }
+  if (power_interval_start < 0) {
+    power_interval_start = t;
+    power_interval_on = produce;
+  }
+
+  // power is no longer recorded after retirement or the end of simulation
+  if (t == exit_time() || t == context()->sim_info().duration - 1) {
+    RecordPowerInterval(t + 1);
+  }
+}
+
+void Reactor::RecordPowerInterval(int end) {
+  if (power_interval_start < 0) {
+    return;
+  }
+
+  context()
+      ->NewDatum("ReactorProductionIntervals")
+      ->AddVal("AgentId", id())
+      ->AddVal("Product", power_name)
+      ->AddVal("SideProduct", false)
+      ->AddVal("StartTime", power_interval_start)
+      ->AddVal("EndTime", end)
+      ->AddVal("Value", power_interval_on ? power_cap : 0.0)
+      ->Record();
+
+  if (hybrid_) {
+    for (int i = 0; i < side_products.size(); i++) {
+      context()
+          ->NewDatum("ReactorProductionIntervals")
+          ->AddVal("AgentId", id())
+          ->AddVal("Product", side_products[i])
+          ->AddVal("SideProduct", true)
+          ->AddVal("StartTime", power_interval_start)
+          ->AddVal("EndTime", end)
+          ->AddVal("Value", power_interval_on ? side_product_quantity[i] : 0.0)
+          ->Record();
+    }
+  }
+  power_interval_start = -1;
 }
 
 void Reactor::RecordSideProduct(bool produce){
@@ -557,13 +1034,28 @@ void Reactor::RecordSideProduct(bool produce){
   }
 }
 
-void Reactor::Record(std::string name, std::string val) {
+void Reactor::Record(Event ev, const MatVec& mats) {
+  if (!record_events) {
+    return;
+  }
+
+  // report the fuel commodity only if all assemblies share one.
+  double qty = 0;
+  int slot = -1;
+  for (int i = 0; i < mats.size(); i++) {
+    qty += mats[i]->quantity();
+    int j = assem_slots[assem_row(mats[i])];
+    slot = (i == 0 || j == slot) ? j : -2;
+  }
+
   context()
       ->NewDatum("ReactorEvents")
       ->AddVal("AgentId", id())
       ->AddVal("Time", context()->time())
-      ->AddVal("Event", name)
-      ->AddVal("Value", val)
+      ->AddVal("Event", kEventNames[ev])
+      ->AddVal("NAssemblies", static_cast<int>(mats.size()))
+      ->AddVal("Quantity", qty)
+      ->AddVal("Commodity", slot >= 0 ? fuel_incommods[slot] : std::string())
       ->Record();
 }
 
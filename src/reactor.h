@@ -1,11 +1,66 @@
 #ifndef CYCAMORE_SRC_REACTOR_H_
 #define CYCAMORE_SRC_REACTOR_H_
 
+#include <deque>
+#include <unordered_map>
+
 #include "cyclus.h"
 #include "cycamore_version.h"
 
 namespace cycamore {
 
+/// BurnupModel computes the composition of spent fuel from its fresh
+/// composition and the burnup it reached.  A single model instance is shared
+/// by all reactors deployed from the same prototype, so implementations
+/// should cache anything expensive to compute.
+class BurnupModel {
+ public:
+  typedef boost::shared_ptr<BurnupModel> Ptr;
+
+  virtual ~BurnupModel() {}
+
+  /// Returns the composition of fuel with the given fresh composition after
+  /// it has been burned to the given burnup (MWd/kg).
+  virtual cyclus::Composition::Ptr Burn(cyclus::Composition::Ptr fresh,
+                                        double burnup) = 0;
+};
+
+/// InterpBurnupModel linearly interpolates spent fuel compositions tabulated
+/// on a grid of fresh fuel enrichments (U235 mass fraction of uranium) and
+/// burnups.  Compositions outside of the grid are clamped to its edges.
+/// Results are cached per fresh composition and burnup, with burnups rounded
+/// to the nearest 0.001 MWd/kg.
+class InterpBurnupModel : public BurnupModel {
+ public:
+  /// @param enrichments ascending enrichment grid points
+  /// @param burnups ascending burnup grid points (MWd/kg)
+  /// @param comps spent fuel compositions for each (enrichment, burnup) grid
+  /// point with burnup varying fastest
+  InterpBurnupModel(const std::vector<double>& enrichments,
+                    const std::vector<double>& burnups,
+                    const std::vector<cyclus::Composition::Ptr>& comps);
+
+  virtual ~InterpBurnupModel() {}
+
+  virtual cyclus::Composition::Ptr Burn(cyclus::Composition::Ptr fresh,
+                                        double burnup);
+
+ private:
+  /// Returns the index i of the grid interval [grid[i], grid[i+1]]
+  /// containing x and sets frac to the position of x within it.
+  static int Locate(const std::vector<double>& grid, double x, double* frac);
+
+  std::vector<double> enrichments_;
+  std::vector<double> burnups_;
+  /// all nuclides present in any tabulated composition
+  std::vector<cyclus::Nuc> nucs_;
+  /// mass fractions of nucs_ for each grid point
+  std::vector<std::vector<double> > table_;
+  /// spent compositions keyed by fresh composition id and rounded burnup,
+  /// cleared when it grows too large
+  std::map<std::pair<int, long long>, cyclus::Composition::Ptr> cache_;
+};
+
 /// Reactor is a simple, general reactor based on static compositional
 /// transformations to model fuel burnup.  The user specifies a set of input
 /// fuels and corresponding burnt compositions that fuel is transformed to when
@@ -116,6 +171,7 @@ class Reactor : public cyclus::Facility,
   virtual void Tock();
   virtual void EnterNotify();
   virtual bool CheckDecommissionCondition();
+  virtual void Decommission();
 
   virtual void AcceptMatlTrades(const std::vector<std::pair<
       cyclus::Trade<cyclus::Material>, cyclus::Material::Ptr> >& responses);
@@ -123,6 +179,10 @@ class Reactor : public cyclus::Facility,
   virtual std::set<cyclus::RequestPortfolio<cyclus::Material>::Ptr>
   GetMatlRequests();
 
+  /// In batch request mode, drops bids that would fill a batch order with a
+  /// partial assembly.
+  virtual void AdjustMatlPrefs(cyclus::PrefMap<cyclus::Material>::type& prefs);
+
   virtual std::set<cyclus::BidPortfolio<cyclus::Material>::Ptr> GetMatlBids(
       cyclus::CommodMap<cyclus::Material>::type& commod_requests);
 
@@ -137,19 +197,49 @@ class Reactor : public cyclus::Facility,
   // Code Injection:
   #include "toolkit/position.cycpp.h"
 
-  std::string fuel_incommod(cyclus::Material::Ptr m);
-  std::string fuel_outcommod(cyclus::Material::Ptr m);
-  std::string fuel_inrecipe(cyclus::Material::Ptr m);
-  std::string fuel_outrecipe(cyclus::Material::Ptr m);
+  const std::string& fuel_incommod(cyclus::Material::Ptr m);
+  const std::string& fuel_outcommod(cyclus::Material::Ptr m);
+  const std::string& fuel_inrecipe(cyclus::Material::Ptr m);
+  const std::string& fuel_outrecipe(cyclus::Material::Ptr m);
   double fuel_pref(cyclus::Material::Ptr m);
 
+  /// Returns the fresh fuel composition for the given fuel slot, looking up
+  /// its recipe only the first time it is needed after a recipe change.
+  cyclus::Composition::Ptr fuel_incomp(int i);
+
+  /// Returns the spent fuel composition for the given fuel slot, looking up
+  /// its recipe only the first time it is needed after a recipe change.
+  cyclus::Composition::Ptr fuel_outcomp(int i);
+
   bool retired() {
     return exit_time() != -1 && context()->time() > exit_time();
   }
 
+  /// Returns the index of the fuel slot requested on the given incommod or
+  /// -1 if the reactor does not request fuel on it.
+  int fuel_slot(const std::string& incommod);
+
+  /// Resolves the preference and recipe changes to fuel slots and orders
+  /// them by time step for consumption in Tick.
+  void ScheduleChanges();
+
   /// Store fuel info index for the given resource received on incommod.
   void index_res(cyclus::Resource::Ptr m, std::string incommod);
 
+  /// Release the fuel info stored for the given resource once it leaves the
+  /// reactor.
+  void unindex_res(cyclus::Resource::Ptr m);
+
+  /// Returns the row of the assembly table holding fuel info for the given
+  /// resource.  Every assembly is indexed as it is accepted (after batch
+  /// orders are split), so only the reactor's own assemblies may be passed.
+  /// @throws KeyError if the resource has no fuel info
+  int assem_row(cyclus::Resource::Ptr m);
+
+  /// Builds the object id to assembly table row lookup from the persisted
+  /// assembly table if it has not been built yet (e.g. after a restart).
+  void IndexAssems();
+
   /// Discharge a batch from the core if there is room in the spent fuel
   /// inventory.  Returns true if a batch was successfully discharged.
   bool Discharge();
@@ -161,27 +251,64 @@ class Reactor : public cyclus::Facility,
   /// fully burnt state as defined by its outrecipe.
   void Transmute();
 
+  /// Records power production (and side products) for the current time
+  /// step - nominal power if produce is true, zero otherwise.
+  void RecordPower(bool produce);
+
   /// Records production of side products from the reactor
   void RecordSideProduct(bool produce);
 
-  /// Transmute the specified number of assemblies in the core to their
-  /// fully burnt state as defined by their outrecipe.
-  void Transmute(int n_assem);
-
-  /// Records a reactor event to the output db with the given name and note val.
-  void Record(std::string name, std::string val);
+  /// Closes the open power production interval (if any) at the given time
+  /// step (exclusive) and records it for power and each side product.
+  void RecordPowerInterval(int end);
 
-  /// Complement of PopSpent - must be called with all materials passed that
-  /// were not traded away to other agents.
-  void PushSpent(std::map<std::string, cyclus::toolkit::MatVec> leftover);
+  /// Computes the first time step at which the reactor's state can change
+  /// again (cycle end, preference/recipe change or retirement) if it is
+  /// currently mid-cycle with full inventories and no spent fuel.  Until
+  /// then Tick, Tock and resource exchange reduce to bookkeeping.
+  void UpdateIdle();
 
-  /// Returns all spent assemblies indexed by outcommod - removing them from
-  /// the spent fuel buffer.
-  std::map<std::string, cyclus::toolkit::MatVec> PopSpent();
+  /// Transmute the specified number of assemblies in the core to their
+  /// fully burnt state as defined by their outrecipe or the burnup model.
+  void Transmute(int n_assem);
 
-  /// Returns all spent assemblies indexed by outcommod without removing them
-  /// from the spent fuel buffer.
-  std::map<std::string, cyclus::toolkit::MatVec> PeekSpent();
+  /// Returns the burnup model to use for transmutation or NULL if fuel is
+  /// transmuted to its outrecipe.  The model is built once per prototype and
+  /// shared with all reactors cloned from it.
+  BurnupModel::Ptr burnup_model_ptr();
+
+  /// Returns the burnup (MWd/kg) of a batch at discharge - i.e. the thermal
+  /// energy produced over a cycle divided by the batch mass.
+  double DischargeBurnup();
+
+  /// Reactor events recorded to the ReactorEvents table.
+  enum Event {
+    CYCLE_START,
+    CYCLE_END,
+    LOAD,
+    DISCHARGE,
+    DISCHARGE_FAILED,
+    TRANSMUTE,
+    RETIRED
+  };
+
+  /// Records a reactor event involving the given assemblies to the output db
+  /// along with their count, total quantity and fuel commodity.
+  void Record(Event ev,
+              const cyclus::toolkit::MatVec& mats = cyclus::toolkit::MatVec());
+
+  /// Pushes the given assemblies onto the spent fuel buffer and appends them
+  /// to the per-outcommod spent fuel index.
+  void PushSpent(cyclus::toolkit::MatVec mats);
+
+  /// Removes the given assemblies from the spent fuel buffer, preserving the
+  /// relative order of the assemblies left behind.  The assemblies must
+  /// already have been removed from the spent fuel index.
+  void PopSpent(const cyclus::toolkit::MatVec& mats);
+
+  /// Builds the per-outcommod spent fuel index from the contents of the
+  /// spent fuel buffer if it has not been built yet (e.g. after a restart).
+  void IndexSpent();
 
   /////// fuel specifications /////////
   #pragma cyclus var { \
@@ -315,6 +442,19 @@ class Reactor : public cyclus::Facility,
   }
   int n_assem_spent;
 
+  #pragma cyclus var { \
+    "default": False, \
+    "uilabel": "Request Fuel in Whole Batches", \
+    "doc": "If true, all fresh fuel needed on a time step is requested as a " \
+           "single all-or-nothing order per fuel commodity rather than one " \
+           "request per assembly.  Received fuel is split into assem_size " \
+           "assemblies on arrival.  This greatly reduces the size of the " \
+           "resource exchange, but fuel can only be received from a " \
+           "supplier able to fill the whole order.", \
+    "uitype": "bool", \
+  }
+  bool batch_requests;
+
    ///////// cycle params ///////////
   #pragma cyclus var { \
     "default": 18, \
@@ -386,6 +526,95 @@ class Reactor : public cyclus::Facility,
   bool hybrid_;
 
 
+  #pragma cyclus var { \
+    "default": False, \
+    "uilabel": "Record Power as Intervals", \
+    "doc": "If true, power and side product production are recorded to the " \
+           "ReactorProductionIntervals table as intervals of constant " \
+           "production (AgentId, Product, SideProduct, StartTime, EndTime, " \
+           "Value) instead of one row per time step to the " \
+           "TimeSeriesPower, TimeSeriessupplyPOWER and ReactorSideProducts " \
+           "tables.  Each interval covers StartTime <= Time < EndTime.  " \
+           "The production_intervals.py script installed with cycamore " \
+           "adds views with the per time step tables' names and columns " \
+           "to an SQLite output database for existing analysis scripts.", \
+    "uitype": "bool", \
+  }
+  bool record_power_intervals;
+
+  #pragma cyclus var {"default": -1, "doc": "This should NEVER be set manually",\
+                      "internal": True \
+  }
+  int power_interval_start;
+
+  #pragma cyclus var {"default": False, "doc": "This should NEVER be set manually",\
+                      "internal": True \
+  }
+  bool power_interval_on;
+
+  #pragma cyclus var { \
+    "default": True, \
+    "uilabel": "Record Reactor Events", \
+    "doc": "If true, reactor events (e.g. cycle start/end, fuel loading and " \
+           "discharge) are recorded to the ReactorEvents table.  Turning " \
+           "this off saves time and database space in large simulations.", \
+    "uitype": "bool", \
+  }
+  bool record_events;
+
+  /////////// burnup model ///////////
+  #pragma cyclus var { \
+    "default": "recipe", \
+    "uilabel": "Burnup Model", \
+    "uitype": "combobox", \
+    "categorical": ["recipe", "interpolate"], \
+    "doc": "How spent fuel compositions are determined.  'recipe' " \
+           "transmutes fuel to the fuel_outrecipe of its fuel type.  " \
+           "'interpolate' interpolates between the burnup_recipes tabulated" \
+           " over burnup_enrichments and burnup_burnups using the fresh " \
+           "fuel's enrichment and its discharge burnup (computed from " \
+           "power_cap, thermal_efficiency, cycle_time and the batch mass).", \
+  }
+  std::string burnup_model;
+
+  #pragma cyclus var { \
+    "default": [], \
+    "uilabel": "Burnup Table Enrichments", \
+    "doc": "Ascending fresh fuel enrichments (U235 mass fraction of " \
+           "uranium) at which spent fuel recipes are tabulated for the " \
+           "'interpolate' burnup model.", \
+  }
+  std::vector<double> burnup_enrichments;
+
+  #pragma cyclus var { \
+    "default": [], \
+    "uilabel": "Burnup Table Burnups", \
+    "units": "MWd/kg", \
+    "doc": "Ascending burnups at which spent fuel recipes are tabulated for " \
+           "the 'interpolate' burnup model.", \
+  }
+  std::vector<double> burnup_burnups;
+
+  #pragma cyclus var { \
+    "default": [], \
+    "uilabel": "Burnup Table Recipes", \
+    "uitype": ["oneormore", "outrecipe"], \
+    "doc": "Spent fuel recipes for each (enrichment, burnup) pair of the " \
+           "'interpolate' burnup model, grouped by enrichment with burnup " \
+           "varying fastest.", \
+  }
+  std::vector<std::string> burnup_recipes;
+
+  #pragma cyclus var { \
+    "default": 0.33, \
+    "uilabel": "Thermal Efficiency", \
+    "uitype": "range", \
+    "range": [0.01, 1.0], \
+    "doc": "Ratio of electrical to thermal power used to compute discharge " \
+           "burnups for the 'interpolate' burnup model.", \
+  }
+  double thermal_efficiency;
+
   /////////// Decommission transmutation behavior ///////////
   #pragma cyclus var {"default": 0, \
                       "uilabel": "Boolean for transmutation behavior upon decommissioning.", \
@@ -452,15 +681,59 @@ class Reactor : public cyclus::Facility,
   }
   bool discharged;
 
-  // This variable should be hidden/unavailable in ui.  Maps resource object
-  // id's to the index for the incommod through which they were received.
-  #pragma cyclus var {"default": {}, "doc": "This should NEVER be set manually", \
+  // These variables should be hidden/unavailable in ui.  Together they form a
+  // dense table with one row of fuel info per assembly held by the reactor:
+  // the resource object id (-1 for free rows) and the index for the incommod
+  // through which it was received.
+  #pragma cyclus var {"default": [], "doc": "This should NEVER be set manually", \
+                      "internal": True \
+  }
+  std::vector<int> assem_ids;
+  #pragma cyclus var {"default": [], "doc": "This should NEVER be set manually", \
                       "internal": True \
   }
-  std::map<int, int> res_indexes;
+  std::vector<int> assem_slots;
+
+  // Maps resource object ids to their assembly table row and tracks free
+  // rows for reuse - rebuilt lazily from assem_ids and no need to persist.
+  // Rows are found by a hashed object id lookup rather than a handle stored
+  // with each assembly because the fresh, core and spent ResBufs only hold
+  // Material::Ptrs and reorder them on every pop and push, so a handle would
+  // need a parallel container mirroring each buffer operation.
+  std::unordered_map<int, int> assem_rows_;
+  std::vector<int> free_rows_;
+  bool assems_indexed_;
+
+  // Preference and recipe changes keyed by time step, each resolved to its
+  // fuel slot and its index into the pref_change_* or recipe_change_* vars.
+  // Built in EnterNotify (or lazily after a restart) and consumed in order
+  // by Tick.
+  std::multimap<int, std::pair<int, int> > pref_changes_;
+  std::multimap<int, std::pair<int, int> >::iterator next_pref_change_;
+  std::multimap<int, std::pair<int, int> > recipe_changes_;
+  std::multimap<int, std::pair<int, int> >::iterator next_recipe_change_;
+  bool changes_scheduled_;
+
+  // Compositions of the current in/out recipes of each fuel slot, reset
+  // whenever the slot's recipes change - populated lazily and no need to
+  // persist.
+  std::vector<cyclus::Composition::Ptr> fuel_incomps_;
+  std::vector<cyclus::Composition::Ptr> fuel_outcomps_;
+
+  // Shared with all reactors of the same prototype - no need to persist.
+  BurnupModel::Ptr burnup_model_;
+
+  // Time step up to which (exclusive) the reactor is idle mid-cycle, or -1
+  // if it isn't.  Recomputed every Tock - no need to persist.
+  int idle_until_;
 
   // populated lazily and no need to persist.
   std::set<std::string> uniq_outcommods_;
+
+  // Spent fuel assemblies grouped by outcommod, oldest first.  Mirrors the
+  // contents of the spent buffer - populated lazily and no need to persist.
+  std::map<std::string, std::deque<cyclus::Material::Ptr> > spent_index_;
+  bool spent_indexed_;
 };
 
 } // namespace cycamore
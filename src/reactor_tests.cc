@@ -107,6 +107,106 @@ TEST(ReactorTests, BatchSizes) {
   EXPECT_EQ(7+3*(simdur-1), qr.rows.size());
 }
 
+// tests that in batch request mode all assemblies needed on a time step are
+// received in a single transaction and split into individual assemblies.
+TEST(ReactorTests, BatchRequests) {
+  std::string config =
+     "  <fuel_inrecipes>  <val>uox</val>      </fuel_inrecipes>  "
+     "  <fuel_outrecipes> <val>spentuox</val> </fuel_outrecipes>  "
+     "  <fuel_incommods>  <val>uox</val>      </fuel_incommods>  "
+     "  <fuel_outcommods> <val>waste</val>    </fuel_outcommods>  "
+     ""
+     "  <cycle_time>1</cycle_time>  "
+     "  <refuel_time>0</refuel_time>  "
+     "  <assem_size>1</assem_size>  "
+     "  <n_assem_core>7</n_assem_core>  "
+     "  <n_assem_batch>3</n_assem_batch>  "
+     "  <batch_requests>1</batch_requests>  ";
+
+  int simdur = 50;
+  cyclus::MockSim sim(cyclus::AgentSpec(":cycamore:Reactor"), config, simdur);
+  sim.AddSource("uox").Finalize();
+  sim.AddSink("waste").Finalize();
+  sim.AddRecipe("uox", c_uox());
+  sim.AddRecipe("spentuox", c_spentuox());
+  int id = sim.Run();
+
+  // one order per time step
+  std::vector<Cond> conds;
+  conds.push_back(Cond("ReceiverId", "==", id));
+  QueryResult qr = sim.db().Query("Transactions", &conds);
+  EXPECT_EQ(simdur, qr.rows.size());
+
+  // initial core order is split into assemblies that are later discharged
+  // individually - 3 per time step.
+  conds.clear();
+  conds.push_back(Cond("SenderId", "==", id));
+  qr = sim.db().Query("Transactions", &conds);
+  EXPECT_EQ(3*(simdur-1), qr.rows.size());
+  Material::Ptr m = sim.GetMaterial(qr.GetVal<int>("ResourceId"));
+  EXPECT_DOUBLE_EQ(1, m->quantity());
+}
+
+// tests that in batch request mode bids for less than a batch order are only
+// accepted if they are a whole number of assemblies.
+TEST(ReactorTests, BatchRequestsPartialOffers) {
+  std::string config =
+     "  <fuel_inrecipes>  <val>uox</val>      </fuel_inrecipes>  "
+     "  <fuel_outrecipes> <val>spentuox</val> </fuel_outrecipes>  "
+     "  <fuel_incommods>  <val>uox</val>      </fuel_incommods>  "
+     "  <fuel_outcommods> <val>waste</val>    </fuel_outcommods>  "
+     ""
+     "  <cycle_time>1</cycle_time>  "
+     "  <refuel_time>0</refuel_time>  "
+     "  <assem_size>1</assem_size>  "
+     "  <n_assem_core>7</n_assem_core>  "
+     "  <n_assem_batch>3</n_assem_batch>  "
+     "  <batch_requests>1</batch_requests>  ";
+
+  int simdur = 5;
+  {
+    // a supplier offering 1.5 assemblies per time step is never used
+    cyclus::MockSim sim(cyclus::AgentSpec(":cycamore:Reactor"), config,
+                        simdur);
+    sim.AddSource("uox").capacity(1.5).Finalize();
+    sim.AddRecipe("uox", c_uox());
+    sim.AddRecipe("spentuox", c_spentuox());
+    int id = sim.Run();
+
+    std::vector<Cond> conds;
+    conds.push_back(Cond("ReceiverId", "==", id));
+    QueryResult qr = sim.db().Query("Transactions", &conds);
+    EXPECT_EQ(0, qr.rows.size());
+  }
+
+  {
+    // a supplier offering 2 assemblies per time step fills part of the order
+    cyclus::MockSim sim(cyclus::AgentSpec(":cycamore:Reactor"), config,
+                        simdur);
+    sim.AddSource("uox").capacity(2).Finalize();
+    sim.AddRecipe("uox", c_uox());
+    sim.AddRecipe("spentuox", c_spentuox());
+    int id = sim.Run();
+
+    std::vector<Cond> conds;
+    conds.push_back(Cond("ReceiverId", "==", id));
+    QueryResult qr = sim.db().Query("Transactions", &conds);
+    ASSERT_LT(0, qr.rows.size());
+    for (int i = 0; i < qr.rows.size(); i++) {
+      Material::Ptr m = sim.GetMaterial(qr.GetVal<int>("ResourceId", i));
+      EXPECT_LE(m->quantity(), 2);
+      EXPECT_DOUBLE_EQ(round(m->quantity()), m->quantity())
+          << "received a partial assembly";
+    }
+
+    // demand is still recorded per assembly
+    conds.clear();
+    conds.push_back(Cond("Time", "==", 0));
+    qr = sim.db().Query("TimeSeriesdemanduox", &conds);
+    EXPECT_EQ(7, qr.rows.size());
+  }
+}
+
 // tests that the refueling period between cycle end and start of the next
 // cycle is honored.
 TEST(ReactorTests, RefuelTimes) {
@@ -176,6 +276,48 @@ TEST(ReactorTests, DecomTimes) {
 }
 
 
+// tests that power is still recorded on every time step while the reactor
+// skips work in the middle of long cycles.
+TEST(ReactorTests, IdleMidCycle) {
+  std::string config =
+     "  <fuel_inrecipes>  <val>uox</val>      </fuel_inrecipes>  "
+     "  <fuel_outrecipes> <val>spentuox</val> </fuel_outrecipes>  "
+     "  <fuel_incommods>  <val>uox</val>      </fuel_incommods>  "
+     "  <fuel_outcommods> <val>waste</val>    </fuel_outcommods>  "
+     ""
+     "  <cycle_time>10</cycle_time>  "
+     "  <refuel_time>2</refuel_time>  "
+     "  <assem_size>1</assem_size>  "
+     "  <n_assem_core>3</n_assem_core>  "
+     "  <power_cap>1000</power_cap>  "
+     "  <n_assem_batch>1</n_assem_batch>  ";
+
+  int simdur = 48;
+  cyclus::MockSim sim(cyclus::AgentSpec(":cycamore:Reactor"), config, simdur);
+  sim.AddSource("uox").Finalize();
+  sim.AddSink("waste").Finalize();
+  sim.AddRecipe("uox", c_uox());
+  sim.AddRecipe("spentuox", c_spentuox());
+  int id = sim.Run();
+
+  // 4 full cycles of 10 operating and 2 refueling time steps
+  std::vector<Cond> conds;
+  conds.push_back(Cond("Value", "==", 1000));
+  QueryResult qr = sim.db().Query("TimeSeriesPower", &conds);
+  EXPECT_EQ(40, qr.rows.size());
+
+  conds.clear();
+  conds.push_back(Cond("Value", "==", 0));
+  qr = sim.db().Query("TimeSeriesPower", &conds);
+  EXPECT_EQ(8, qr.rows.size());
+
+  // one assembly for each of the 4 refuelings after the initial core
+  conds.clear();
+  conds.push_back(Cond("ReceiverId", "==", id));
+  qr = sim.db().Query("Transactions", &conds);
+  EXPECT_EQ(3+4, qr.rows.size());
+}
+
 // Tests if a reactor produces power at the time of its decommission
 // given a refuel_time of zero.
 TEST(ReactorTests, DecomZeroRefuel) {
@@ -418,6 +560,117 @@ TEST(ReactorTests, DischargedFuelTransmute) {
   EXPECT_TRUE(mq.mass(942390000) > 0) << "transmuted spent fuel doesn't have Pu239";
 }
 
+// tests that reactor events are recorded with their assembly count, quantity
+// and fuel commodity.
+TEST(ReactorTests, RecordEvents) {
+  std::string config =
+     "  <fuel_inrecipes>  <val>uox</val>      </fuel_inrecipes>  "
+     "  <fuel_outrecipes> <val>spentuox</val> </fuel_outrecipes>  "
+     "  <fuel_incommods>  <val>uox</val>      </fuel_incommods>  "
+     "  <fuel_outcommods> <val>waste</val>    </fuel_outcommods>  "
+     ""
+     "  <cycle_time>4</cycle_time>  "
+     "  <refuel_time>3</refuel_time>  "
+     "  <assem_size>2</assem_size>  "
+     "  <n_assem_core>3</n_assem_core>  "
+     "  <n_assem_batch>1</n_assem_batch>  ";
+
+  int simdur = 7;
+  cyclus::MockSim sim(cyclus::AgentSpec(":cycamore:Reactor"), config, simdur);
+  sim.AddSource("uox").Finalize();
+  sim.AddRecipe("uox", c_uox());
+  sim.AddRecipe("spentuox", c_spentuox());
+  int id = sim.Run();
+
+  std::vector<Cond> conds;
+  conds.push_back(Cond("Event", "==", std::string("LOAD")));
+  QueryResult qr = sim.db().Query("ReactorEvents", &conds);
+  EXPECT_EQ(3, qr.GetVal<int>("NAssemblies", 0));
+  EXPECT_DOUBLE_EQ(6, qr.GetVal<double>("Quantity", 0));
+  EXPECT_EQ("uox", qr.GetVal<std::string>("Commodity", 0));
+
+  conds.clear();
+  conds.push_back(Cond("Event", "==", std::string("DISCHARGE")));
+  qr = sim.db().Query("ReactorEvents", &conds);
+  EXPECT_EQ(1, qr.rows.size());
+  EXPECT_EQ(4, qr.GetVal<int>("Time"));
+  EXPECT_EQ(1, qr.GetVal<int>("NAssemblies"));
+  EXPECT_DOUBLE_EQ(2, qr.GetVal<double>("Quantity"));
+}
+
+// tests that the interpolating burnup model produces spent fuel between the
+// tabulated compositions bracketing the discharge burnup.
+TEST(ReactorTests, InterpolatedBurnup) {
+  // with 1 MWe at 100% efficiency, 1 kg batches and the default time step
+  // duration the discharge burnup is about 30.4 MWd/kg - half way up the
+  // tabulated burnups.
+  std::string config =
+     "  <fuel_inrecipes>  <val>uox</val>      </fuel_inrecipes>  "
+     "  <fuel_outrecipes> <val>spentuox</val> </fuel_outrecipes>  "
+     "  <fuel_incommods>  <val>uox</val>      </fuel_incommods>  "
+     "  <fuel_outcommods> <val>waste</val>    </fuel_outcommods>  "
+     ""
+     "  <cycle_time>1</cycle_time>  "
+     "  <refuel_time>0</refuel_time>  "
+     "  <assem_size>1</assem_size>  "
+     "  <n_assem_core>1</n_assem_core>  "
+     "  <n_assem_batch>1</n_assem_batch>  "
+     "  <power_cap>1</power_cap>  "
+     "  <thermal_efficiency>1</thermal_efficiency>  "
+     ""
+     "  <burnup_model>interpolate</burnup_model>  "
+     "  <burnup_enrichments> <val>0.03</val> <val>0.05</val> </burnup_enrichments>  "
+     "  <burnup_burnups>     <val>0</val>    <val>60.9</val> </burnup_burnups>  "
+     "  <burnup_recipes>  "
+     "    <val>uox</val> <val>spentuox</val> <val>uox</val> <val>spentuox</val>  "
+     "  </burnup_recipes>  ";
+
+  int simdur = 2;
+  cyclus::MockSim sim(cyclus::AgentSpec(":cycamore:Reactor"), config, simdur);
+  sim.AddSource("uox").Finalize();
+  sim.AddSink("waste").Finalize();
+  sim.AddRecipe("uox", c_uox());
+  sim.AddRecipe("spentuox", c_spentuox());
+  int id = sim.Run();
+
+  std::vector<Cond> conds;
+  conds.push_back(Cond("SenderId", "==", id));
+  int resid = sim.db().Query("Transactions", &conds).GetVal<int>("ResourceId");
+  Material::Ptr m = sim.GetMaterial(resid);
+  MatQuery mq(m);
+  MatQuery spent(Material::CreateUntracked(1, c_spentuox()));
+  EXPECT_GT(mq.mass_frac(942390000), 0.4 * spent.mass_frac(942390000));
+  EXPECT_LT(mq.mass_frac(942390000), 0.6 * spent.mass_frac(942390000));
+}
+
+// tests that burnups within the cache tolerance share a spent composition.
+TEST(ReactorTests, InterpolatedBurnupCache) {
+  std::vector<double> enrichments;
+  enrichments.push_back(0.03);
+  enrichments.push_back(0.05);
+  std::vector<double> burnups;
+  burnups.push_back(0);
+  burnups.push_back(60.9);
+  std::vector<Composition::Ptr> comps;
+  comps.push_back(c_uox());
+  comps.push_back(c_spentuox());
+  comps.push_back(c_uox());
+  comps.push_back(c_spentuox());
+  InterpBurnupModel model(enrichments, burnups, comps);
+
+  Composition::Ptr c = model.Burn(c_uox(), 30.4501);
+  EXPECT_EQ(c, model.Burn(c_uox(), 30.4502));
+  EXPECT_NE(c, model.Burn(c_uox(), 30.46));
+
+  // drifting burnups keep working once the cache has been cleared
+  for (int i = 0; i < 5000; i++) {
+    model.Burn(c_uox(), 0.01 * i);
+  }
+  MatQuery mq(Material::CreateUntracked(1, model.Burn(c_uox(), 30.4501)));
+  EXPECT_DOUBLE_EQ(mq.mass_frac(942390000),
+      MatQuery(Material::CreateUntracked(1, c)).mass_frac(942390000));
+}
+
 // tests that spent fuel is offerred on correct commods according to the
 // incommod it was received on - esp when dealing with multiple fuel commods
 // simultaneously.
@@ -758,6 +1011,122 @@ TEST(ReactorTests, MultipleByProduct) {
 
 }
 
+// tests that power and side products are recorded as intervals of constant
+// production when requested.
+TEST(ReactorTests, PowerIntervals) {
+  std::string config =
+     "  <fuel_inrecipes>  <val>uox</val>      </fuel_inrecipes>  "
+     "  <fuel_outrecipes> <val>spentuox</val> </fuel_outrecipes>  "
+     "  <fuel_incommods>  <val>uox</val>      </fuel_incommods>  "
+     "  <fuel_outcommods> <val>waste</val>    </fuel_outcommods>  "
+     ""
+     "  <cycle_time>4</cycle_time>  "
+     "  <refuel_time>2</refuel_time>  "
+     "  <assem_size>1</assem_size>  "
+     "  <n_assem_core>1</n_assem_core>  "
+     "  <n_assem_batch>1</n_assem_batch>  "
+     "  <power_cap>1000</power_cap>  "
+     "  <record_power_intervals>1</record_power_intervals>  "
+     ""
+     "  <side_products> <val>process_heat</val> </side_products>"
+     "  <side_product_quantity> <val>10</val> </side_product_quantity>";
+
+  int simdur = 12;
+  cyclus::MockSim sim(cyclus::AgentSpec(":cycamore:Reactor"), config, simdur);
+  sim.AddSource("uox").Finalize();
+  sim.AddRecipe("uox", c_uox());
+  sim.AddRecipe("spentuox", c_spentuox());
+  int id = sim.Run();
+
+  // operating for 4 time steps and refueling for 2, twice
+  std::vector<Cond> conds;
+  conds.push_back(Cond("Product", "==", std::string("power")));
+  QueryResult qr = sim.db().Query("ReactorProductionIntervals", &conds);
+  EXPECT_EQ(4, qr.rows.size());
+
+  conds.push_back(Cond("Value", "==", 1000));
+  qr = sim.db().Query("ReactorProductionIntervals", &conds);
+  EXPECT_EQ(2, qr.rows.size());
+  EXPECT_EQ(0, qr.GetVal<int>("StartTime", 0));
+  EXPECT_EQ(4, qr.GetVal<int>("EndTime", 0));
+
+  conds.clear();
+  conds.push_back(Cond("Product", "==", std::string("process_heat")));
+  conds.push_back(Cond("Value", "==", 0));
+  qr = sim.db().Query("ReactorProductionIntervals", &conds);
+  EXPECT_EQ(2, qr.rows.size());
+  EXPECT_EQ(10, qr.GetVal<int>("StartTime", 1));
+  EXPECT_EQ(simdur, qr.GetVal<int>("EndTime", 1));
+}
+
+// tests that expanding the production intervals over the time steps they
+// cover gives the same rows as recording power every time step.
+TEST(ReactorTests, PowerIntervalsLegacyShape) {
+  std::string config =
+     "  <fuel_inrecipes>  <val>uox</val>      </fuel_inrecipes>  "
+     "  <fuel_outrecipes> <val>spentuox</val> </fuel_outrecipes>  "
+     "  <fuel_incommods>  <val>uox</val>      </fuel_incommods>  "
+     "  <fuel_outcommods> <val>waste</val>    </fuel_outcommods>  "
+     ""
+     "  <cycle_time>4</cycle_time>  "
+     "  <refuel_time>2</refuel_time>  "
+     "  <assem_size>1</assem_size>  "
+     "  <n_assem_core>1</n_assem_core>  "
+     "  <n_assem_batch>1</n_assem_batch>  "
+     "  <power_cap>1000</power_cap>  "
+     ""
+     "  <side_products> <val>process_heat</val> </side_products>"
+     "  <side_product_quantity> <val>10</val> </side_product_quantity>";
+
+  int simdur = 12;
+  cyclus::MockSim steps(cyclus::AgentSpec(":cycamore:Reactor"), config,
+                        simdur);
+  steps.AddSource("uox").Finalize();
+  steps.AddRecipe("uox", c_uox());
+  steps.AddRecipe("spentuox", c_spentuox());
+  steps.Run();
+
+  cyclus::MockSim intervals(
+      cyclus::AgentSpec(":cycamore:Reactor"),
+      config + "<record_power_intervals>1</record_power_intervals>", simdur);
+  intervals.AddSource("uox").Finalize();
+  intervals.AddRecipe("uox", c_uox());
+  intervals.AddRecipe("spentuox", c_spentuox());
+  intervals.Run();
+
+  // expand the intervals into per time step values
+  std::map<std::pair<std::string, int>, double> expanded;
+  QueryResult qr = intervals.db().Query("ReactorProductionIntervals", NULL);
+  for (int i = 0; i < qr.rows.size(); i++) {
+    std::string product = qr.GetVal<bool>("SideProduct", i) ?
+        qr.GetVal<std::string>("Product", i) : "power";
+    for (int t = qr.GetVal<int>("StartTime", i);
+         t < qr.GetVal<int>("EndTime", i); t++) {
+      EXPECT_EQ(0, expanded.count(std::make_pair(product, t)))
+          << "overlapping intervals for " << product << " at time " << t;
+      expanded[std::make_pair(product, t)] = qr.GetVal<double>("Value", i);
+    }
+  }
+
+  qr = steps.db().Query("TimeSeriesPower", NULL);
+  EXPECT_EQ(simdur, qr.rows.size());
+  for (int i = 0; i < qr.rows.size(); i++) {
+    std::pair<std::string, int> key("power", qr.GetVal<int>("Time", i));
+    ASSERT_EQ(1, expanded.count(key)) << "no power interval at " << key.second;
+    EXPECT_DOUBLE_EQ(qr.GetVal<double>("Value", i), expanded[key]);
+  }
+
+  qr = steps.db().Query("ReactorSideProducts", NULL);
+  EXPECT_EQ(simdur, qr.rows.size());
+  for (int i = 0; i < qr.rows.size(); i++) {
+    std::pair<std::string, int> key(qr.GetVal<std::string>("Product", i),
+                                    qr.GetVal<int>("Time", i));
+    ASSERT_EQ(1, expanded.count(key)) << "no side product interval at "
+                                      << key.second;
+    EXPECT_DOUBLE_EQ(qr.GetVal<double>("Value", i), expanded[key]);
+  }
+  EXPECT_EQ(2 * simdur, expanded.size());
+}
+
 } // namespace reactortests
 } // namespace cycamore
-
@@ -0,0 +1,240 @@
+// Microbenchmark of the Enrichment facility's exchange hot paths.
+//
+// Drives Enrichment::GetMatlBids, AdjustMatlPrefs and GetMatlTrades directly
+// with synthetic requests and reports the time per request/bid/trade and the
+// number of heap allocations per trade, for each number of requesters.
+//
+//     enrichment_bench [--assays M] [--feed-lots F] [--reps R] N [N ...]
+//
+// M is the number of distinct requested product assays, F the number of
+// separate feed materials in the facility's inventory and R the number of
+// repetitions averaged per measurement.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "env.h"
+#include "logger.h"
+#include "test_context.h"
+
+#include "enrichment.h"
+
+static long long n_allocs = 0;
+
+void* operator new(std::size_t size) {
+  n_allocs++;
+  void* p = std::malloc(size == 0 ? 1 : size);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace cycamore {
+
+using cyclus::Bid;
+using cyclus::BidPortfolio;
+using cyclus::CompMap;
+using cyclus::Composition;
+using cyclus::Material;
+using cyclus::Request;
+using cyclus::Trade;
+
+typedef std::chrono::steady_clock Clock;
+
+/// Builds Enrichment facilities with a given feed inventory and exercises them
+/// with synthetic requests.  Friend of Enrichment.
+class EnrichmentBench {
+ public:
+  EnrichmentBench(int n_assays, int n_feed_lots)
+      : n_assays_(n_assays), n_feed_lots_(n_feed_lots) {
+    CompMap v;
+    v[922350000] = 0.0072;
+    v[922380000] = 0.9928;
+    natu_ = Composition::CreateFromMass(v);
+    tc_.get()->AddRecipe("natu", natu_);
+    // reactors request a few distinct recipes, shared by many requesters
+    for (int i = 0; i < n_assays_; i++) {
+      double assay = 0.03 + 0.02 * i / std::max(1, n_assays_ - 1);
+      CompMap p;
+      p[922350000] = assay;
+      p[922380000] = 1 - assay;
+      products_.push_back(Composition::CreateFromMass(p));
+      CompMap f;
+      f[922350000] = 0.002 + 0.006 * i / std::max(1, n_assays_ - 1);
+      f[922380000] = 1 - f[922350000];
+      feeds_.push_back(Composition::CreateFromMass(f));
+    }
+  }
+
+  /// @return a new facility holding n_feed_lots_ feed materials
+  Enrichment* Facility() {
+    Enrichment* e = new Enrichment(tc_.get());
+    e->feed_commod = "natu";
+    e->feed_recipe = "natu";
+    e->product_commod = "enr_u";
+    e->tails_commod = "tails";
+    e->tails_assay = 0.002;
+    e->SetMaxInventorySize(1e12);
+    e->SwuCapacity(1e12);
+    for (int i = 0; i < n_feed_lots_; i++) {
+      e->AddMat_(Material::CreateUntracked(1e9 / n_feed_lots_, natu_));
+    }
+    e->Tick();
+    return e;
+  }
+
+  /// @return n product requests cycling through the distinct assays
+  std::vector<Request<Material>*> ProductRequests(int n) {
+    std::vector<Request<Material>*> reqs;
+    for (int i = 0; i < n; i++) {
+      Material::Ptr target =
+          Material::CreateUntracked(1000, products_[i % n_assays_]);
+      reqs.push_back(Request<Material>::Create(target, tc_.trader(), "enr_u"));
+    }
+    return reqs;
+  }
+
+  /// @return a feed request from e with n bids cycling through the distinct
+  /// feed compositions
+  cyclus::PrefMap<Material>::type FeedPrefs(Enrichment* e, int n) {
+    cyclus::PrefMap<Material>::type prefs;
+    Material::Ptr target = Material::CreateUntracked(1000, natu_);
+    Request<Material>* req = Request<Material>::Create(target, e, "natu");
+    for (int i = 0; i < n; i++) {
+      Material::Ptr offer =
+          Material::CreateUntracked(1000, feeds_[i % n_assays_]);
+      prefs[req][Bid<Material>::Create(req, offer, tc_.trader())] = 1;
+    }
+    return prefs;
+  }
+
+  void Run(int n, int reps) {
+    std::vector<Request<Material>*> reqs = ProductRequests(n);
+    cyclus::CommodMap<Material>::type commod_reqs;
+    commod_reqs["enr_u"] = reqs;
+
+    double bid_ns = 0;
+    double pref_ns = 0;
+    double trade_ns = 0;
+    long long trade_allocs = 0;
+    long long n_trades = 0;
+    for (int r = 0; r < reps; r++) {
+      Enrichment* e = Facility();
+
+      Clock::time_point start = Clock::now();
+      std::set<BidPortfolio<Material>::Ptr> ports = e->GetMatlBids(commod_reqs);
+      bid_ns += Elapsed(start);
+
+      cyclus::PrefMap<Material>::type prefs = FeedPrefs(e, n);
+      start = Clock::now();
+      e->AdjustMatlPrefs(prefs);
+      pref_ns += Elapsed(start);
+      ClearPrefs(prefs);
+
+      std::vector<Trade<Material> > trades;
+      std::set<BidPortfolio<Material>::Ptr>::iterator pit;
+      for (pit = ports.begin(); pit != ports.end(); ++pit) {
+        const std::set<Bid<Material>*>& bids = (*pit)->bids();
+        std::set<Bid<Material>*>::const_iterator bit;
+        for (bit = bids.begin(); bit != bids.end(); ++bit) {
+          trades.push_back(Trade<Material>((*bit)->request(), *bit, 1));
+        }
+      }
+      std::vector<std::pair<Trade<Material>, Material::Ptr> > responses;
+      responses.reserve(trades.size());
+      long long allocs = n_allocs;
+      start = Clock::now();
+      e->GetMatlTrades(trades, responses);
+      trade_ns += Elapsed(start);
+      trade_allocs += n_allocs - allocs;
+      n_trades += trades.size();
+
+      delete e;
+    }
+    for (int i = 0; i < reqs.size(); i++) {
+      delete reqs[i];
+    }
+
+    std::printf("%9d %7d %9d %12.1f %12.1f %12.1f %12.1f\n", n, n_assays_,
+                n_feed_lots_, bid_ns / (reps * n), pref_ns / (reps * n),
+                trade_ns / std::max(1LL, n_trades),
+                static_cast<double>(trade_allocs) / std::max(1LL, n_trades));
+    std::fflush(stdout);
+  }
+
+  static void ClearPrefs(cyclus::PrefMap<Material>::type& prefs) {
+    cyclus::PrefMap<Material>::type::iterator it;
+    for (it = prefs.begin(); it != prefs.end(); ++it) {
+      std::map<Bid<Material>*, double>::iterator bit;
+      for (bit = it->second.begin(); bit != it->second.end(); ++bit) {
+        delete bit->first;
+      }
+      delete it->first;
+    }
+    prefs.clear();
+  }
+
+ private:
+  static double Elapsed(Clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - start)
+        .count();
+  }
+
+  cyclus::TestContext tc_;
+  int n_assays_;
+  int n_feed_lots_;
+  Composition::Ptr natu_;
+  std::vector<Composition::Ptr> products_;
+  std::vector<Composition::Ptr> feeds_;
+};
+
+}  // namespace cycamore
+
+int main(int argc, char* argv[]) {
+  cyclus::Env::SetNucDataPath();
+  cyclus::Logger::ReportLevel() = cyclus::LEV_ERROR;
+
+  int n_assays = 5;
+  int n_feed_lots = 1;
+  int reps = 5;
+  std::vector<int> ns;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--assays" && i + 1 < argc) {
+      n_assays = std::atoi(argv[++i]);
+    } else if (arg == "--feed-lots" && i + 1 < argc) {
+      n_feed_lots = std::atoi(argv[++i]);
+    } else if (arg == "--reps" && i + 1 < argc) {
+      reps = std::atoi(argv[++i]);
+    } else if (arg == "--help" || arg == "-h") {
+      std::cout << "usage: enrichment_bench [--assays M] [--feed-lots F]"
+                << " [--reps R] N [N ...]" << std::endl;
+      return 0;
+    } else {
+      ns.push_back(std::atoi(argv[i]));
+    }
+  }
+  if (ns.empty()) {
+    int defaults[] = {10, 100, 1000, 10000};
+    ns.assign(defaults, defaults + 4);
+  }
+
+  std::printf("%9s %7s %9s %12s %12s %12s %12s\n", "requests", "assays",
+              "feed lots", "bid ns/req", "pref ns/bid", "trade ns",
+              "allocs/trade");
+  cycamore::EnrichmentBench bench(n_assays, n_feed_lots);
+  for (int i = 0; i < ns.size(); i++) {
+    bench.Run(ns[i], reps);
+  }
+  return 0;
+}
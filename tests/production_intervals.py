@@ -0,0 +1,80 @@
+#!/usr/bin/python3
+"""Adds per time step views of the ReactorProductionIntervals table to an
+SQLite cyclus output database.
+
+Reactors with record_power_intervals on record power and side products as
+intervals of constant production instead of one row per time step.  This
+script expands the intervals back into views named and shaped like the
+TimeSeriesPower, TimeSeriessupplyPOWER and ReactorSideProducts tables so
+existing analysis scripts keep working.  A view is only added if the database
+has no table of that name, i.e. if no reactor recorded per time step rows.
+
+Example:
+
+    $ python3 production_intervals.py cyclus.sqlite
+"""
+import argparse
+import sqlite3
+
+EXPAND = """
+  FROM ReactorProductionIntervals AS i
+  JOIN TimeList AS t
+    ON t.SimId = i.SimId AND t.TimeStep >= i.StartTime
+       AND t.TimeStep < i.EndTime
+"""
+
+POWER = ("SELECT i.SimId, i.AgentId, t.TimeStep AS Time, i.Value" + EXPAND +
+         "WHERE i.SideProduct = 0")
+
+VIEWS = {
+    "TimeSeriesPower": POWER,
+    "TimeSeriessupplyPOWER": POWER,
+    "ReactorSideProducts": (
+        "SELECT i.SimId, i.AgentId, t.TimeStep AS Time, i.Product, i.Value" +
+        EXPAND + "WHERE i.SideProduct != 0"),
+}
+
+
+def tables(conn):
+    """Returns the names of the tables and views in the database."""
+    rows = conn.execute("SELECT name FROM sqlite_master "
+                        "WHERE type IN ('table', 'view')").fetchall()
+    return set(r[0] for r in rows)
+
+
+def create_views(conn):
+    """Creates the per time step views missing from the database connected to
+    by conn and returns their names.  Nothing is created if the database has
+    no ReactorProductionIntervals table.
+    """
+    have = tables(conn)
+    if "ReactorProductionIntervals" not in have:
+        return []
+    created = []
+    for name in sorted(VIEWS):
+        if name in have:
+            continue
+        conn.execute("CREATE VIEW {0} AS {1}".format(name, VIEWS[name]))
+        created.append(name)
+    conn.commit()
+    return created
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("db", help="SQLite cyclus output database")
+    args = parser.parse_args()
+
+    conn = sqlite3.connect(args.db)
+    try:
+        created = create_views(conn)
+    finally:
+        conn.close()
+    if created:
+        print("added views " + ", ".join(created))
+    else:
+        print("no views added")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,60 @@
+import sqlite3
+
+import production_intervals as pi
+
+
+def intervals_db():
+    """Returns an in-memory database holding one reactor's production over 6
+    time steps, operating for the first 4.
+    """
+    conn = sqlite3.connect(":memory:")
+    conn.execute("CREATE TABLE TimeList (SimId BLOB, TimeStep INTEGER)")
+    conn.execute("CREATE TABLE ReactorProductionIntervals (SimId BLOB, "
+                 "AgentId INTEGER, Product TEXT, SideProduct INTEGER, "
+                 "StartTime INTEGER, EndTime INTEGER, Value REAL)")
+    for t in range(6):
+        conn.execute("INSERT INTO TimeList VALUES (?, ?)", ("sim", t))
+    rows = [("power", 0, 0, 4, 1000.0), ("power", 0, 4, 6, 0.0),
+            ("heat", 1, 0, 4, 10.0), ("heat", 1, 4, 6, 0.0)]
+    for product, side, start, end, value in rows:
+        conn.execute("INSERT INTO ReactorProductionIntervals "
+                     "VALUES (?, ?, ?, ?, ?, ?, ?)",
+                     ("sim", 7, product, side, start, end, value))
+    return conn
+
+
+def test_power_views():
+    conn = intervals_db()
+    assert sorted(pi.VIEWS) == pi.create_views(conn)
+
+    exp = [("sim", 7, t, 1000.0 if t < 4 else 0.0) for t in range(6)]
+    for view in ["TimeSeriesPower", "TimeSeriessupplyPOWER"]:
+        obs = conn.execute("SELECT SimId, AgentId, Time, Value FROM " + view +
+                           " ORDER BY Time").fetchall()
+        assert exp == obs
+
+
+def test_side_product_view():
+    conn = intervals_db()
+    pi.create_views(conn)
+    exp = [("sim", 7, t, "heat", 10.0 if t < 4 else 0.0) for t in range(6)]
+    obs = conn.execute("SELECT SimId, AgentId, Time, Product, Value "
+                       "FROM ReactorSideProducts ORDER BY Time").fetchall()
+    assert exp == obs
+
+
+def test_existing_tables_kept():
+    conn = intervals_db()
+    conn.execute("CREATE TABLE TimeSeriesPower (SimId BLOB, AgentId INTEGER, "
+                 "Time INTEGER, Value REAL)")
+    created = pi.create_views(conn)
+    assert "TimeSeriesPower" not in created
+    assert "TimeSeriessupplyPOWER" in created
+
+    # running again adds nothing
+    assert [] == pi.create_views(conn)
+
+
+def test_no_intervals():
+    conn = sqlite3.connect(":memory:")
+    assert [] == pi.create_views(conn)
@@ -0,0 +1,141 @@
+// Reactor archetype that times itself, for the reactor fleet benchmark.
+//
+// TimedReactor behaves exactly like cycamore's Reactor but adds up the wall
+// time it spends in each phase of a time step and records the totals to the
+// ReactorPhaseTimes table after the last time step or when it is
+// decommissioned.  It is built as its own module, only with
+// 'make reactor_bench', and loaded by reactor_bench.py with
+//
+//     <spec> <lib>timed_reactor</lib> <name>TimedReactor</name> </spec>
+//
+// so the Reactor archetype itself carries no benchmarking code.
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#include "reactor.h"
+
+namespace cycamore {
+
+typedef std::chrono::steady_clock Clock;
+
+class TimedReactor : public Reactor {
+ public:
+  /// Phases of a time step.  Trades sent and received are timed separately
+  /// because they are separate calls in the exchange.
+  enum Phase {
+    TICK,
+    REQUEST,
+    BID,
+    TRADE,
+    ACCEPT,
+    TOCK,
+    N_PHASES
+  };
+
+  explicit TimedReactor(cyclus::Context* ctx) : Reactor(ctx) {
+    std::fill(secs_, secs_ + N_PHASES, 0.0);
+    std::fill(calls_, calls_ + N_PHASES, 0);
+  }
+
+  virtual ~TimedReactor() {}
+
+  virtual cyclus::Agent* Clone() {
+    TimedReactor* m = new TimedReactor(context());
+    m->InitFrom(this);
+    return m;
+  }
+
+  virtual void Tick() {
+    Timer t(this, TICK);
+    Reactor::Tick();
+  }
+
+  virtual void Tock() {
+    {
+      Timer t(this, TOCK);
+      Reactor::Tock();
+    }
+    if (context()->time() == context()->sim_info().duration - 1) {
+      Record();
+    }
+  }
+
+  virtual void Decommission() {
+    Record();
+    Reactor::Decommission();
+  }
+
+  virtual std::set<cyclus::RequestPortfolio<cyclus::Material>::Ptr>
+  GetMatlRequests() {
+    Timer t(this, REQUEST);
+    return Reactor::GetMatlRequests();
+  }
+
+  virtual std::set<cyclus::BidPortfolio<cyclus::Material>::Ptr> GetMatlBids(
+      cyclus::CommodMap<cyclus::Material>::type& commod_requests) {
+    Timer t(this, BID);
+    return Reactor::GetMatlBids(commod_requests);
+  }
+
+  virtual void GetMatlTrades(
+      const std::vector<cyclus::Trade<cyclus::Material> >& trades,
+      std::vector<std::pair<cyclus::Trade<cyclus::Material>,
+                            cyclus::Material::Ptr> >& responses) {
+    Timer t(this, TRADE);
+    Reactor::GetMatlTrades(trades, responses);
+  }
+
+  virtual void AcceptMatlTrades(const std::vector<std::pair<
+      cyclus::Trade<cyclus::Material>, cyclus::Material::Ptr> >& responses) {
+    Timer t(this, ACCEPT);
+    Reactor::AcceptMatlTrades(responses);
+  }
+
+ private:
+  /// Adds the wall time spent in its scope and one call to a phase's totals.
+  class Timer {
+   public:
+    Timer(TimedReactor* r, Phase p) : r_(r), p_(p), start_(Clock::now()) {}
+
+    ~Timer() {
+      std::chrono::duration<double> dt = Clock::now() - start_;
+      r_->secs_[p_] += dt.count();
+      r_->calls_[p_]++;
+    }
+
+   private:
+    TimedReactor* r_;
+    Phase p_;
+    Clock::time_point start_;
+  };
+
+  /// Records the totals of each phase since the last call and resets them.
+  void Record() {
+    static const std::string names[] = {
+      "Tick", "Request", "Bid", "Trade", "Accept", "Tock",
+    };
+    for (int i = 0; i < N_PHASES; i++) {
+      context()
+          ->NewDatum("ReactorPhaseTimes")
+          ->AddVal("AgentId", id())
+          ->AddVal("Phase", names[i])
+          ->AddVal("Calls", calls_[i])
+          ->AddVal("Seconds", secs_[i])
+          ->Record();
+      secs_[i] = 0;
+      calls_[i] = 0;
+    }
+  }
+
+  // wall time (seconds) spent in and number of calls to each phase since the
+  // totals were last recorded
+  double secs_[N_PHASES];
+  int calls_[N_PHASES];
+};
+
+}  // namespace cycamore
+
+extern "C" cyclus::Agent* ConstructTimedReactor(cyclus::Context* ctx) {
+  return new cycamore::TimedReactor(ctx);
+}